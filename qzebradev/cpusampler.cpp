@@ -0,0 +1,385 @@
+#include "cpusampler.h"
+#include "nativestack.h"
+#include <QThread>
+#include <QWaitCondition>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#define QZebraDev_CPUSAMPLER_SUPPORTED
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+using namespace QZebraDev;
+
+static const int SAMPLE_MAX_DEPTH = 48;
+static const int BUFFER_SAMPLES = 128;  //! NOTE More than samples between drains (100 ms) for 1000 Hz
+static const int HANDLER_FRAMES = 2;    //! NOTE The handler and the signal trampoline
+static const int DRAIN_INTERVAL_MS = 100;
+
+struct Sample {
+    int count;
+    void *frames[SAMPLE_MAX_DEPTH];
+};
+
+//! NOTE Ring buffer of a thread, single writer (the signal handler on the thread)
+struct QZebraDev::CpuSampleBuffer {
+    int tid;
+    QString name;
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+    timer_t timer;
+#endif
+    bool hasTimer;
+    Sample samples[BUFFER_SAMPLES];
+    QAtomicInteger<quint32> head;   //! NOTE Written by the signal handler on the thread
+    QAtomicInteger<quint32> tail;   //! NOTE Written by the reader, under mutex
+    QAtomicInteger<quint32> lost;
+    CpuSampleBuffer() : tid(0), hasTimer(false), head(0), tail(0), lost(0) {}
+};
+
+class CpuSampler::Worker : public QThread
+{
+public:
+    explicit Worker(CpuSampler *sampler)
+        : m_sampler(sampler), m_stop(false), m_tid(0) {}
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wait.wakeOne();
+        }
+        wait();
+    }
+
+    int tid() const { return m_tid.loadAcquire(); }
+
+protected:
+    void run()
+    {
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+        m_tid.storeRelease(static_cast<int>(syscall(SYS_gettid)));
+#endif
+        forever {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (!m_stop) {
+                    m_wait.wait(&m_mutex, DRAIN_INTERVAL_MS);
+                }
+                if (m_stop) {
+                    return;
+                }
+            }
+
+            m_sampler->tick();
+        }
+    }
+
+private:
+    CpuSampler *m_sampler;
+    bool m_stop;
+    QAtomicInt m_tid;
+    QMutex m_mutex;
+    QWaitCondition m_wait;
+};
+
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+//! NOTE Only atomics and backtrace here (see the risk of backtrace in cpusampler.h), the buffer is given by the timer (sival_ptr)
+static void sampleHandler(int signo, siginfo_t *info, void *context)
+{
+    Q_UNUSED(signo);
+    Q_UNUSED(context);
+    int savedErrno = errno;
+
+    CpuSampleBuffer *buf = 0;
+    if (info && info->si_code == SI_TIMER) {
+        buf = static_cast<CpuSampleBuffer *>(info->si_value.sival_ptr);
+    }
+
+    if (buf) {
+        quint32 head = buf->head.load();
+        if (head - buf->tail.loadAcquire() >= static_cast<quint32>(BUFFER_SAMPLES)) {
+            buf->lost.fetchAndAddRelaxed(1);
+        } else {
+            Sample &s = buf->samples[head % BUFFER_SAMPLES];
+            s.count = backtrace(s.frames, SAMPLE_MAX_DEPTH);
+            buf->head.storeRelease(head + 1);
+        }
+    }
+
+    errno = savedErrno;
+}
+
+//! NOTE CPU time clock of other thread by tid, as pthread_getcpuclockid of glibc (CPUCLOCK_PERTHREAD | CPUCLOCK_SCHED)
+static clockid_t threadCpuClock(int tid)
+{
+    return static_cast<clockid_t>((~static_cast<unsigned int>(tid) << 3) | 4 | 2);
+}
+#endif
+
+CpuSampler::CpuSampler()
+    : m_lost(0), m_signo(0), m_intervalNs(0), m_running(false), m_worker(0)
+{
+}
+
+CpuSampler::~CpuSampler()
+{
+    stop();
+    qDeleteAll(m_buffers);
+    qDeleteAll(m_finished);
+}
+
+bool CpuSampler::start(int hz)
+{
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+    stop();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_signo == 0) {
+        //! NOTE The first call of backtrace loads libgcc, it is not async-signal-safe, so not in the handler
+        void *frames[1];
+        backtrace(frames, 1);
+
+        int signo = SIGRTMIN + 6;
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = &sampleHandler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        if (sigaction(signo, &sa, 0) == -1) {
+            fprintf(stderr, "Debug: CpuSampler can not install signal handler, errno: %d\n", errno);
+            fflush(stderr);
+            return false;
+        }
+        m_signo = signo;
+    }
+
+    m_intervalNs = Q_INT64_C(1000000000) / qBound(1, hz, static_cast<int>(MAX_HZ));
+    m_running = true;
+
+    //! NOTE Samples before start are skipped
+    foreach (CpuSampleBuffer *buf, m_buffers) {
+        buf->tail.storeRelease(buf->head.loadAcquire());
+    }
+
+    m_worker = new Worker(this);
+    m_worker->start();
+    locker.unlock();
+
+    tick();
+    return true;
+#else
+    Q_UNUSED(hz);
+    return false;
+#endif
+}
+
+void CpuSampler::stop()
+{
+    if (m_worker) {
+        m_worker->stop();
+        delete m_worker;
+        m_worker = 0;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_running) {
+        return;
+    }
+
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+    foreach (CpuSampleBuffer *buf, m_buffers) {
+        if (buf->hasTimer) {
+            timer_delete(buf->timer);
+            buf->hasTimer = false;
+        }
+    }
+#endif
+
+    m_running = false;
+    locker.unlock();
+
+    drain();
+}
+
+bool CpuSampler::isRunning() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_running;
+}
+
+void CpuSampler::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_stacks.clear();
+    m_lost = 0;
+}
+
+quint64 CpuSampler::lostCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_lost;
+}
+
+void CpuSampler::tick()
+{
+    addThreads();
+    drain();
+}
+
+void CpuSampler::addThreads()
+{
+#if defined(QZebraDev_CPUSAMPLER_SUPPORTED)
+    QMutexLocker locker(&m_mutex);
+    if (!m_running) {
+        return;
+    }
+
+    int workerTid = m_worker ? m_worker->tid() : 0;
+    QStringList tids = QDir("/proc/self/task").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+
+    //! NOTE Finished threads, tid can be reused, so the buffer is not reused (it can have samples of the old thread)
+    QHash<int, CpuSampleBuffer*>::Iterator it = m_buffers.begin();
+    while (it != m_buffers.end()) {
+        CpuSampleBuffer *buf = it.value();
+        if (tids.contains(QString::number(buf->tid))) {
+            ++it;
+            continue;
+        }
+
+        if (buf->hasTimer) {
+            timer_delete(buf->timer);
+            buf->hasTimer = false;
+        }
+        m_finished.append(buf);
+        it = m_buffers.erase(it);
+    }
+
+    foreach (const QString &tidStr, tids) {
+        int tid = tidStr.toInt();
+        if (tid <= 0 || tid == workerTid) {
+            continue;
+        }
+
+        CpuSampleBuffer *buf = m_buffers.value(tid, 0);
+        if (buf && buf->hasTimer) {
+            continue;
+        }
+
+        if (!buf) {
+            buf = new CpuSampleBuffer();
+            buf->tid = tid;
+            m_buffers.insert(tid, buf);
+        }
+
+        QFile comm(QString("/proc/self/task/%1/comm").arg(tid));
+        buf->name = comm.open(QFile::ReadOnly) ? QString::fromUtf8(comm.readAll()).trimmed().replace(';', ',') : QString();
+        if (buf->name.isEmpty()) {
+            buf->name = QString::number(tid);
+        }
+
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = m_signo;
+        sev.sigev_value.sival_ptr = buf;
+        sev.sigev_notify_thread_id = tid;
+
+        if (timer_create(threadCpuClock(tid), &sev, &buf->timer) == -1) {
+            continue; //! NOTE Thread is finished
+        }
+
+        struct itimerspec its;
+        its.it_interval.tv_sec = m_intervalNs / Q_INT64_C(1000000000);
+        its.it_interval.tv_nsec = m_intervalNs % Q_INT64_C(1000000000);
+        its.it_value = its.it_interval;
+        if (timer_settime(buf->timer, 0, &its, 0) == -1) {
+            timer_delete(buf->timer);
+            continue;
+        }
+
+        buf->hasTimer = true;
+    }
+#endif
+}
+
+void CpuSampler::drain()
+{
+    QMutexLocker locker(&m_mutex);
+    foreach (CpuSampleBuffer *buf, m_buffers) {
+        drainBuffer(buf);
+    }
+
+    foreach (CpuSampleBuffer *buf, m_finished) {
+        drainBuffer(buf);
+    }
+    qDeleteAll(m_finished);
+    m_finished.clear();
+}
+
+//! NOTE Must be called under m_mutex
+void CpuSampler::drainBuffer(CpuSampleBuffer *buf)
+{
+    quint32 head = buf->head.loadAcquire();
+    quint32 tail = buf->tail.load();
+
+    QHash<QString, quint64> &stacks = m_stacks[buf->name];
+    for (; tail != head; ++tail) {
+        const Sample &s = buf->samples[tail % BUFFER_SAMPLES];
+
+        //! NOTE From the outermost, return addresses - 1 are inside of the call
+        QString folded;
+        for (int i = s.count - 1; i >= HANDLER_FRAMES; --i) {
+            void *addr = s.frames[i];
+            if (i > HANDLER_FRAMES) {
+                addr = static_cast<char *>(addr) - 1;
+            }
+
+            QHash<void*, QString>::ConstIterator it = m_names.constFind(addr);
+            if (it == m_names.constEnd()) {
+                //! NOTE ';' separates frames, it can be in names
+                it = m_names.insert(addr, NativeStack::symbolName(addr).replace(';', ','));
+            }
+
+            if (!folded.isEmpty()) {
+                folded += ';';
+            }
+            folded += it.value();
+        }
+
+        if (!folded.isEmpty()) {
+            ++stacks[folded];
+        }
+    }
+
+    buf->tail.storeRelease(tail);
+    m_lost += buf->lost.fetchAndStoreRelaxed(0);
+}
+
+QHash<QString, quint64> CpuSampler::stacks(bool perThread) const
+{
+    const_cast<CpuSampler *>(this)->drain();
+
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, quint64> result;
+    QHash<QString, QHash<QString, quint64> >::ConstIterator tit = m_stacks.constBegin();
+    for (; tit != m_stacks.constEnd(); ++tit) {
+        QHash<QString, quint64>::ConstIterator it = tit.value().constBegin();
+        for (; it != tit.value().constEnd(); ++it) {
+            result[perThread ? tit.key() + ';' + it.key() : it.key()] += it.value();
+        }
+    }
+    return result;
+}
@@ -0,0 +1,73 @@
+#ifndef QZebraDev_CPUSAMPLER_H
+#define QZebraDev_CPUSAMPLER_H
+
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QAtomicInteger>
+
+namespace QZebraDev
+{
+
+struct CpuSampleBuffer;
+
+/**
+ * @brief Statistical sampling CPU profiler, used by Profiler (startSampling)
+ *
+ * Each thread of the process (/proc/self/task, new threads are added by the worker) gets
+ * a timer on its CPU time clock, with signal delivery to the thread (SIGEV_THREAD_ID).
+ * The handler saves the native stack (backtrace) to the ring buffer of the thread
+ * (single writer, no locks). The worker thread drains buffers, symbolizes and aggregates
+ * folded stacks (outer;...;inner -> samples), so reading is cheap.
+ * Buffers of finished threads are freed after they are drained (a finished thread gets no signals),
+ * buffers of live threads are kept while the sampler exists, a signal can be delivered after stop.
+ * Linux (glibc) only, else start returns false.
+ *
+ * backtrace is not async-signal-safe: the unwinder can take the lock of the dynamic loader
+ * (dl_iterate_phdr), so a sample inside dlopen / dlclose of the same thread can deadlock it,
+ * and the first call loads libgcc (it is made by start). Unwinders with _dl_find_object (libgcc 12,
+ * glibc 2.35) do not take the lock. A frame pointer walk is not used, builds omit frame pointers.
+ * So the rate is limited (MAX_HZ) and sampling is for diagnostic sessions, not always on.
+ */
+class CpuSampler
+{
+public:
+    CpuSampler();
+    ~CpuSampler();
+
+    static const int MAX_HZ = 1000;
+
+    bool start(int hz = 99);    //! NOTE Bounded by MAX_HZ
+    void stop();
+    bool isRunning() const;
+
+    //! NOTE Folded stack (outer;...;inner) -> samples, prefixed by thread name if perThread
+    QHash<QString, quint64> stacks(bool perThread = true) const;
+    quint64 lostCount() const;
+
+    void clear();
+
+private:
+    class Worker;
+
+    void tick();
+    void addThreads();
+    void drain();
+    void drainBuffer(CpuSampleBuffer *buf);
+
+    mutable QMutex m_mutex;
+    QHash<int, CpuSampleBuffer*> m_buffers; //! NOTE By tid
+    QList<CpuSampleBuffer*> m_finished;     //! NOTE Of finished threads, freed by drain
+    QHash<QString, QHash<QString, quint64> > m_stacks; //! NOTE By thread name
+    QHash<void*, QString> m_names;     //! NOTE Symbolization cache
+    quint64 m_lost;
+    int m_signo;
+    qint64 m_intervalNs;
+    bool m_running;
+    Worker *m_worker;
+};
+
+}
+
+#endif // QZebraDev_CPUSAMPLER_H
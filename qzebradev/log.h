@@ -23,13 +23,25 @@
 
 #define IF_LOGLEVEL(level)  if(QZebraDev::Logger::instance()->isLevel(level))
 
-#define LOG_STREAM(type, tag) QZebraDev::LogStream(type, tag).stream()
+//! NOTE Level of tag (see Logger::setTagLevel) is cached in static slot of call site.
+//! The slot is a static of the lambda, each lambda expression has own type, so each call site has own slot
+//! (in inline functions it is one for all translation units, as for any static there)
+#define LOG_SITE() ([]() -> QZebraDev::LogSite& { static QZebraDev::LogSite s; return s; }())
+
+//! NOTE The for statements declare the slot and the check result, and the if ends with else,
+//! so the macro is a single statement and an else after it is not bound to the inner if
+#define IF_LOGLEVEL_TAG(level, tag) \
+    for (QZebraDev::LogSite *__logSite = &LOG_SITE(); __logSite; __logSite = 0) \
+        for (int __logSiteCheck = __logSite->check(level); __logSite; __logSite = 0) \
+            if (__logSiteCheck == 0 || (__logSiteCheck < 0 && !__logSite->resolve(level, tag))) {} else
+
+#define LOG_STREAM(type, tag) QZebraDev::LogStream(type, tag, __FILE__, __LINE__, Q_FUNC_INFO).stream()
 #define LOG(type, tag)  LOG_STREAM(type, tag) << FUNCNAME(Q_FUNC_INFO)
 
-#define LOGE()      IF_LOGLEVEL(QZebraDev::Logger::Normal) LOG(QZebraDev::Logger::ERROR, LOG_TAG)
-#define LOGW()      IF_LOGLEVEL(QZebraDev::Logger::Normal) LOG(QZebraDev::Logger::WARN, LOG_TAG)
-#define LOGI()      IF_LOGLEVEL(QZebraDev::Logger::Normal) LOG(QZebraDev::Logger::INFO, LOG_TAG)
-#define LOGD()      IF_LOGLEVEL(QZebraDev::Logger::Debug) LOG(QZebraDev::Logger::DEBUG, LOG_TAG)
+#define LOGE()      IF_LOGLEVEL_TAG(QZebraDev::Logger::Normal, LOG_TAG) LOG(QZebraDev::Logger::ERROR, LOG_TAG)
+#define LOGW()      IF_LOGLEVEL_TAG(QZebraDev::Logger::Normal, LOG_TAG) LOG(QZebraDev::Logger::WARN, LOG_TAG)
+#define LOGI()      IF_LOGLEVEL_TAG(QZebraDev::Logger::Normal, LOG_TAG) LOG(QZebraDev::Logger::INFO, LOG_TAG)
+#define LOGD()      IF_LOGLEVEL_TAG(QZebraDev::Logger::Debug, LOG_TAG) LOG(QZebraDev::Logger::DEBUG, LOG_TAG)
 
 //! Helps
 #define DEPRECATED LOGD() << "This function deprecated!!";
@@ -0,0 +1,280 @@
+#include "logclock.h"
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <math.h>
+#include <string.h>
+
+#if defined(Q_OS_UNIX)
+#include <time.h>
+#endif
+
+namespace QZebraDev {
+
+//! NOTE msecs = msecs of point + (ticks - ticks of point) * msecsPerTick
+struct LogClockCalibration {
+    qint64 ticks;
+    double msecs;
+    double msecsPerTick;
+    LogClockCalibration() : ticks(0), msecs(0), msecsPerTick(0) {}
+};
+
+}
+
+using namespace QZebraDev;
+
+static const double MAX_DRIFT_MSECS = 1.0;
+
+//! NOTE Calibration is a seqlock over atomic fields (doubles as bits), odd sequence - is being written, 0 - not initialized.
+//! So nothing is allocated and retired, readers copy the fields and retry if the sequence is changed
+static QAtomicInt s_seq;
+static QAtomicInteger<qint64> s_ticks;
+static QAtomicInteger<qint64> s_msecs;
+static QAtomicInteger<qint64> s_msecsPerTick;
+static QMutex s_mutex;
+
+static inline qint64 doubleBits(double v)
+{
+    qint64 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static inline double bitsDouble(qint64 bits)
+{
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+//! NOTE Must be called under s_mutex
+static void storeCalibration(const LogClockCalibration &c)
+{
+    s_seq.fetchAndAddOrdered(1);
+    s_ticks.storeRelease(c.ticks);
+    s_msecs.storeRelease(doubleBits(c.msecs));
+    s_msecsPerTick.storeRelease(doubleBits(c.msecsPerTick));
+    s_seq.fetchAndAddRelease(1);
+}
+
+static bool loadCalibration(LogClockCalibration &c)
+{
+    forever {
+        int seq = s_seq.loadAcquire();
+        if (seq == 0) {
+            return false;
+        }
+        if (seq & 1) {
+            continue;
+        }
+
+        //! NOTE Acquire loads, so the sequence is read again after them
+        c.ticks = s_ticks.loadAcquire();
+        c.msecs = bitsDouble(s_msecs.loadAcquire());
+        c.msecsPerTick = bitsDouble(s_msecsPerTick.loadAcquire());
+        if (s_seq.load() == seq) {
+            return true;
+        }
+    }
+}
+
+#if defined(QZebraDev_LOGCLOCK_USE_TSC)
+static qint64 s_originTicks = 0;
+static qint64 s_originNsecs = 0;
+#endif
+
+class CalibrationThread : public QThread
+{
+public:
+    explicit CalibrationThread(int intervalMs)
+        : m_intervalMs(intervalMs), m_stop(false) {}
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wait.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (!m_stop) {
+                    m_wait.wait(&m_mutex, m_intervalMs);
+                }
+                if (m_stop) {
+                    return;
+                }
+            }
+
+            LogClock::calibrate();
+        }
+    }
+
+private:
+    unsigned long m_intervalMs;
+    bool m_stop;
+    QMutex m_mutex;
+    QWaitCondition m_wait;
+};
+
+static CalibrationThread *s_thread = 0;
+static QMutex s_threadMutex;
+
+static QElapsedTimer startedTimer()
+{
+    QElapsedTimer timer;
+    timer.start();
+    return timer;
+}
+
+static double wallMSecs()
+{
+#if defined(Q_OS_UNIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<double>(ts.tv_sec) * 1000.0 + static_cast<double>(ts.tv_nsec) / 1000000.0;
+#else
+    return static_cast<double>(QDateTime::currentMSecsSinceEpoch());
+#endif
+}
+
+#if defined(QZebraDev_LOGCLOCK_USE_TSC)
+static qint64 monotonicNsecs()
+{
+#if defined(Q_OS_UNIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+#else
+    static const QElapsedTimer timer = startedTimer();
+    return timer.nsecsElapsed();
+#endif
+}
+#endif
+
+qint64 LogClock::elapsedTicks()
+{
+    static const QElapsedTimer timer = startedTimer();
+    return timer.nsecsElapsed();
+}
+
+LogClockCalibration LogClock::calibration()
+{
+    LogClockCalibration c;
+    if (loadCalibration(c)) {
+        return c;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    if (loadCalibration(c)) {
+        return c;
+    }
+
+#if defined(QZebraDev_LOGCLOCK_USE_TSC)
+    //! NOTE Initial rate of TSC by 1 ms, it is refined by the calibration thread
+    s_originTicks = ticks();
+    s_originNsecs = monotonicNsecs();
+    qint64 nsecs = s_originNsecs;
+    qint64 t = s_originTicks;
+    while (nsecs - s_originNsecs < 1000000 || t == s_originTicks) {
+        nsecs = monotonicNsecs();
+        t = ticks();
+    }
+    c.msecsPerTick = (static_cast<double>(nsecs - s_originNsecs) / 1000000.0) / static_cast<double>(t - s_originTicks);
+#else
+    c.msecsPerTick = 1.0 / 1000000.0; //! NOTE Ticks are nanoseconds
+#endif
+
+    c.ticks = ticks();
+    c.msecs = wallMSecs();
+
+    storeCalibration(c);
+    return c;
+}
+
+int LogClock::generation()
+{
+    calibration();
+    return s_seq.loadAcquire() >> 1;
+}
+
+void LogClock::calibrate()
+{
+    LogClockCalibration c = calibration();
+
+    qint64 t = ticks();
+    double wall = wallMSecs();
+
+    double msecsPerTick = c.msecsPerTick;
+#if defined(QZebraDev_LOGCLOCK_USE_TSC)
+    qint64 nsecs = monotonicNsecs();
+    if (t > s_originTicks && nsecs - s_originNsecs > Q_INT64_C(1000000000)) {
+        msecsPerTick = (static_cast<double>(nsecs - s_originNsecs) / 1000000.0) / static_cast<double>(t - s_originTicks);
+    }
+#endif
+
+    double predicted = c.msecs + static_cast<double>(t - c.ticks) * c.msecsPerTick;
+    if (qAbs(predicted - wall) <= MAX_DRIFT_MSECS) {
+        return;
+    }
+
+    LogClockCalibration nc;
+    nc.ticks = t;
+    nc.msecs = wall;
+    nc.msecsPerTick = msecsPerTick;
+
+    QMutexLocker locker(&s_mutex);
+    storeCalibration(nc);
+}
+
+qint64 LogClock::toMSecsSinceEpoch(qint64 ticks)
+{
+    LogClockCalibration c = calibration();
+    return static_cast<qint64>(floor(c.msecs + static_cast<double>(ticks - c.ticks) * c.msecsPerTick));
+}
+
+qint64 LogClock::fromMSecsSinceEpoch(qint64 msecs)
+{
+    //! NOTE To the middle of millisecond, so the back conversion gives the same msecs
+    LogClockCalibration c = calibration();
+    return c.ticks + qRound64((static_cast<double>(msecs) + 0.5 - c.msecs) / c.msecsPerTick);
+}
+
+QDateTime LogClock::toDateTime(qint64 ticks)
+{
+    return QDateTime::fromMSecsSinceEpoch(toMSecsSinceEpoch(ticks));
+}
+
+void LogClock::startCalibration(int intervalMs)
+{
+    QMutexLocker locker(&s_threadMutex);
+    if (s_thread) {
+        return;
+    }
+
+    calibration();
+
+    s_thread = new CalibrationThread(intervalMs);
+    s_thread->start();
+}
+
+void LogClock::stopCalibration()
+{
+    QMutexLocker locker(&s_threadMutex);
+    if (!s_thread) {
+        return;
+    }
+
+    s_thread->stop();
+    delete s_thread;
+    s_thread = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef QZebraDev_LOGCLOCK_H
+#define QZebraDev_LOGCLOCK_H
+
+#include <QtGlobal>
+#include <QDateTime>
+
+#if defined(QZebraDev_LOGCLOCK_TSC) && defined(Q_PROCESSOR_X86)
+#define QZebraDev_LOGCLOCK_USE_TSC
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#elif defined(Q_OS_UNIX)
+#include <time.h>
+#endif
+
+namespace QZebraDev
+{
+
+struct LogClockCalibration;
+
+/**
+ * @brief Raw monotonic ticks of log messages, converted to wall time only when formatting
+ *
+ * Ticks are nanoseconds of CLOCK_MONOTONIC (CLOCK_MONOTONIC_COARSE with QZebraDev_LOGCLOCK_COARSE),
+ * or TSC with QZebraDev_LOGCLOCK_TSC (x86, invariant TSC is expected).
+ * The calibration maps ticks to milliseconds since epoch. It is updated by the calibration thread
+ * only if wall time is drifted more than 1 ms (NTP, manual change), messages keep the order of ticks.
+ */
+class LogClock
+{
+public:
+
+    static inline qint64 ticks()
+    {
+#if defined(QZebraDev_LOGCLOCK_USE_TSC)
+        return static_cast<qint64>(__rdtsc());
+#elif defined(Q_OS_UNIX)
+        struct timespec ts;
+#if defined(QZebraDev_LOGCLOCK_COARSE) && defined(CLOCK_MONOTONIC_COARSE)
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        return static_cast<qint64>(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+#else
+        return elapsedTicks();
+#endif
+    }
+
+    static qint64 toMSecsSinceEpoch(qint64 ticks);
+    static qint64 fromMSecsSinceEpoch(qint64 msecs);
+    static QDateTime toDateTime(qint64 ticks);
+
+    static void calibrate(); //! NOTE Updates calibration if wall time is drifted
+    static int generation(); //! NOTE Changed on each calibration update, values converted by old calibration are stale
+
+    static void startCalibration(int intervalMs = 1000);
+    static void stopCalibration();
+
+private:
+    static LogClockCalibration calibration();
+    static qint64 elapsedTicks();
+};
+
+}
+
+#endif // QZebraDev_LOGCLOCK_H
@@ -0,0 +1,235 @@
+#include "logcodec.h"
+#include <string.h>
+
+using namespace QZebraDev;
+
+const quint32 LogCodec::FRAME_MAGIC = 0x424C5A51; //! NOTE QZLB
+const int LogCodec::MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+static const int MINMATCH = 4;
+static const int HASH_LOG = 12;
+static const int MFLIMIT = 12;
+static const int LASTLITERALS = 5;
+static const int MAX_DISTANCE = 65535;
+
+static inline quint32 read32(const uchar *p)
+{
+    quint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uchar *writeLength(uchar *op, int len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uchar>(len);
+    return op;
+}
+
+int LogCodec::compress(const char *source, int size, char *dest)
+{
+    const uchar *src = reinterpret_cast<const uchar *>(source);
+    uchar *op = reinterpret_cast<uchar *>(dest);
+
+    int table[1 << HASH_LOG];
+    for (int i = 0; i < (1 << HASH_LOG); ++i) {
+        table[i] = -1;
+    }
+
+    int ip = 0;
+    int anchor = 0;
+    const int limit = size - MFLIMIT;
+    const int matchLimit = size - LASTLITERALS;
+
+    while (ip < limit) {
+        quint32 seq = read32(src + ip);
+        quint32 h = (seq * 2654435761u) >> (32 - HASH_LOG);
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > MAX_DISTANCE || read32(src + ref) != seq) {
+            ++ip;
+            continue;
+        }
+
+        int matchLen = MINMATCH;
+        while (ip + matchLen < matchLimit && src[ref + matchLen] == src[ip + matchLen]) {
+            ++matchLen;
+        }
+
+        int litLen = ip - anchor;
+        uchar *token = op++;
+        *token = static_cast<uchar>((litLen >= 15 ? 15 : litLen) << 4);
+        if (litLen >= 15) {
+            op = writeLength(op, litLen - 15);
+        }
+        memcpy(op, src + anchor, litLen);
+        op += litLen;
+
+        int offset = ip - ref;
+        *op++ = static_cast<uchar>(offset & 0xFF);
+        *op++ = static_cast<uchar>(offset >> 8);
+
+        int ml = matchLen - MINMATCH;
+        *token |= static_cast<uchar>(ml >= 15 ? 15 : ml);
+        if (ml >= 15) {
+            op = writeLength(op, ml - 15);
+        }
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    int litLen = size - anchor;
+    *op++ = static_cast<uchar>((litLen >= 15 ? 15 : litLen) << 4);
+    if (litLen >= 15) {
+        op = writeLength(op, litLen - 15);
+    }
+    memcpy(op, src + anchor, litLen);
+    op += litLen;
+
+    return static_cast<int>(op - reinterpret_cast<uchar *>(dest));
+}
+
+int LogCodec::decompress(const char *source, int size, char *dest, int destSize)
+{
+    const uchar *src = reinterpret_cast<const uchar *>(source);
+    uchar *dst = reinterpret_cast<uchar *>(dest);
+
+    int ip = 0;
+    int op = 0;
+    while (ip < size) {
+        int token = src[ip++];
+
+        int litLen = token >> 4;
+        if (litLen == 15) {
+            int b = 255;
+            while (b == 255) {
+                if (ip >= size) {
+                    return -1;
+                }
+                b = src[ip++];
+                litLen += b;
+            }
+        }
+
+        if (litLen > size - ip || litLen > destSize - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        if (ip == size) { //! NOTE Last sequence has only literals
+            break;
+        }
+
+        if (size - ip < 2) {
+            return -1;
+        }
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+
+        int matchLen = token & 15;
+        if (matchLen == 15) {
+            int b = 255;
+            while (b == 255) {
+                if (ip >= size) {
+                    return -1;
+                }
+                b = src[ip++];
+                matchLen += b;
+            }
+        }
+        matchLen += MINMATCH;
+
+        if (matchLen > destSize - op) {
+            return -1;
+        }
+
+        const uchar *match = dst + op - offset;
+        if (offset >= matchLen) {
+            memcpy(dst + op, match, matchLen);
+        } else {
+            for (int i = 0; i < matchLen; ++i) { //! NOTE Overlapped, repeats the pattern
+                dst[op + i] = match[i];
+            }
+        }
+        op += matchLen;
+    }
+
+    return op == destSize ? op : -1;
+}
+
+int LogCodec::compressBound(int size)
+{
+    return size + size / 255 + 16;
+}
+
+QByteArray LogCodec::frame(const char *data, int size)
+{
+    QByteArray out;
+    out.resize(sizeof(FrameHeader) + compressBound(size));
+
+    char *payload = out.data() + sizeof(FrameHeader);
+    int compSize = compress(data, size, payload);
+
+    FrameHeader h;
+    h.magic = FRAME_MAGIC;
+    h.rawSize = static_cast<quint32>(size);
+    h.flags = 0;
+    if (compSize >= size) {
+        memcpy(payload, data, size);
+        compSize = size;
+        h.flags |= Stored;
+    }
+    h.size = static_cast<quint32>(compSize);
+
+    memcpy(out.data(), &h, sizeof(h));
+    out.resize(sizeof(FrameHeader) + compSize);
+    return out;
+}
+
+bool LogCodec::isFramed(const char *data, qint64 size)
+{
+    if (size < static_cast<qint64>(sizeof(FrameHeader))) {
+        return false;
+    }
+
+    quint32 magic;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == FRAME_MAGIC;
+}
+
+qint64 LogCodec::readFrame(const char *data, qint64 size, qint64 offset, QByteArray &raw)
+{
+    if (offset < 0 || size - offset < static_cast<qint64>(sizeof(FrameHeader))) {
+        return -1;
+    }
+
+    FrameHeader h;
+    memcpy(&h, data + offset, sizeof(h));
+    if (h.magic != FRAME_MAGIC || h.rawSize > static_cast<quint32>(MAX_FRAME_SIZE) || h.size > h.rawSize
+            || static_cast<qint64>(h.size) > size - offset - static_cast<qint64>(sizeof(FrameHeader))) {
+        return -1;
+    }
+
+    const char *payload = data + offset + sizeof(FrameHeader);
+    raw.resize(h.rawSize);
+    if (h.flags & Stored) {
+        if (h.size != h.rawSize) {
+            return -1;
+        }
+        memcpy(raw.data(), payload, h.size);
+    } else if (decompress(payload, h.size, raw.data(), h.rawSize) == -1) {
+        return -1;
+    }
+
+    return sizeof(FrameHeader) + h.size;
+}
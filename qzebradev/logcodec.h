@@ -0,0 +1,47 @@
+#ifndef QZebraDev_LOGCODEC_H
+#define QZebraDev_LOGCODEC_H
+
+#include <QByteArray>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Self-contained block compression of log files (LZ4 block format)
+ *
+ * Compressed file is a sequence of independent frames:
+ * header (magic "QZLB", raw size, compressed size, flags), payload.
+ * Every frame is decompressed without others, so readers can seek by frames (see LogIndexWriter).
+ */
+class LogCodec
+{
+public:
+
+    enum FrameFlags {
+        Stored = 0x1    //! NOTE Payload is not compressed (not compressible data)
+    };
+
+    struct FrameHeader {
+        quint32 magic;
+        quint32 rawSize;
+        quint32 size;
+        quint32 flags;
+    };
+
+    static const quint32 FRAME_MAGIC;
+    static const int MAX_FRAME_SIZE;
+
+    static int compressBound(int size);
+    static int compress(const char *src, int size, char *dst);              //! NOTE Returns compressed size
+    static int decompress(const char *src, int size, char *dst, int dstSize); //! NOTE Returns dstSize, or -1 if data is corrupted
+
+    static QByteArray frame(const char *data, int size);
+    static bool isFramed(const char *data, qint64 size);
+
+    //! NOTE Reads frame at offset, returns size of frame, or -1
+    static qint64 readFrame(const char *data, qint64 size, qint64 offset, QByteArray &raw);
+};
+
+}
+
+#endif // QZebraDev_LOGCODEC_H
@@ -0,0 +1,279 @@
+#include "logconfigwatcher.h"
+#include <QSettings>
+#include <QFileInfo>
+#include <QFile>
+#include <QStringList>
+#include <QThread>
+#include <stdio.h>
+
+#include "logdefdest.h"
+
+#if defined(Q_OS_LINUX)
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace QZebraDev;
+
+static const QString DEFAULT_CONSOLE_LAYOUT("${time} | ${type|5} | ${tag|26} | ${thread} | ${message}");
+static const QString DEFAULT_FILE_LAYOUT("${datetime} | ${type|5} | ${tag|26} | ${thread} | ${message}");
+
+#if defined(Q_OS_LINUX)
+class LogConfigWatcher::WatchThread : public QThread
+{
+public:
+    explicit WatchThread(const QString &filePath)
+        : m_filePath(filePath), m_stopFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+
+    ~WatchThread()
+    {
+        if (m_stopFd != -1) {
+            close(m_stopFd);
+        }
+    }
+
+    bool isValid() const { return m_stopFd != -1; }
+
+    void stop()
+    {
+        quint64 val = 1;
+        if (::write(m_stopFd, &val, sizeof(val)) != sizeof(val)) {
+            fprintf(stderr, "Debug: LogConfigWatcher can not stop watch thread\n");
+            fflush(stderr);
+        }
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "Debug: LogConfigWatcher can not init inotify, errno: %d\n", errno);
+            fflush(stderr);
+            return;
+        }
+
+        QFileInfo fi(m_filePath);
+        QByteArray dir = QFile::encodeName(fi.absolutePath());
+        QByteArray name = QFile::encodeName(fi.fileName());
+
+        //! NOTE Watch the directory, editors often replace the file by rename
+        if (inotify_add_watch(fd, dir.constData(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+            fprintf(stderr, "Debug: LogConfigWatcher can not watch %s, errno: %d\n", dir.constData(), errno);
+            fflush(stderr);
+            close(fd);
+            return;
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_stopFd;
+        fds[1].events = POLLIN;
+
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+        forever {
+            fds[0].revents = 0;
+            fds[1].revents = 0;
+            if (poll(fds, 2, -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            if (fds[1].revents) { //! NOTE Stop
+                break;
+            }
+
+            bool changed = false;
+            ssize_t len = 0;
+            while ((len = read(fd, buf, sizeof(buf))) > 0) {
+                for (char *ptr = buf; ptr < buf + len; ) {
+                    const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(ptr);
+                    if (ev->len > 0 && name == ev->name) {
+                        changed = true;
+                    }
+                    ptr += sizeof(struct inotify_event) + ev->len;
+                }
+            }
+
+            if (changed) {
+                LogConfigWatcher::apply(m_filePath);
+            }
+        }
+
+        close(fd);
+    }
+
+private:
+    QString m_filePath;
+    int m_stopFd;
+};
+#else
+class LogConfigWatcher::WatchThread : public QThread
+{
+public:
+    explicit WatchThread(const QString &) {}
+    bool isValid() const { return false; }
+    void stop() {}
+};
+#endif
+
+LogConfigWatcher::LogConfigWatcher(const QString &filePath)
+    : m_filePath(filePath), m_thread(0)
+{
+}
+
+LogConfigWatcher::~LogConfigWatcher()
+{
+    stop();
+}
+
+QString LogConfigWatcher::filePath() const
+{
+    return m_filePath;
+}
+
+bool LogConfigWatcher::start()
+{
+    if (m_thread) {
+        return true;
+    }
+
+    apply(m_filePath);
+
+    m_thread = new WatchThread(m_filePath);
+    if (!m_thread->isValid()) {
+        fprintf(stderr, "Debug: LogConfigWatcher is not supported or can not be started\n");
+        fflush(stderr);
+        delete m_thread;
+        m_thread = 0;
+        return false;
+    }
+
+    m_thread->start();
+    return true;
+}
+
+void LogConfigWatcher::stop()
+{
+    if (m_thread) {
+        m_thread->stop();
+        delete m_thread;
+        m_thread = 0;
+    }
+}
+
+bool LogConfigWatcher::isRunning() const
+{
+    return m_thread != 0;
+}
+
+bool LogConfigWatcher::apply(const QString &filePath)
+{
+    Logger *logger = Logger::instance();
+
+    Logger::Config config = logger->config();
+    QList<LogDest *> dests;
+    bool hasDests = false;
+    if (!parse(filePath, config, dests, hasDests)) {
+        return false;
+    }
+
+    logger->setConfig(config);
+
+    if (hasDests) {
+        logger->setDests(dests);
+    }
+
+    return true;
+}
+
+static QString stringValue(const QSettings &s, const QString &key, const QString &def)
+{
+    QVariant val = s.value(key, def);
+    if (val.type() == QVariant::StringList) { //! NOTE Not quoted value with commas
+        return val.toStringList().join(", ");
+    }
+    return val.toString();
+}
+
+bool LogConfigWatcher::parse(const QString &filePath, Logger::Config &config, QList<LogDest *> &dests, bool &hasDests)
+{
+    if (!QFileInfo(filePath).exists()) {
+        return false;
+    }
+
+    QSettings s(filePath, QSettings::IniFormat);
+    if (s.status() != QSettings::NoError) {
+        fprintf(stderr, "Debug: LogConfigWatcher can not parse %s\n", qPrintable(filePath));
+        fflush(stderr);
+        return false;
+    }
+
+    s.beginGroup("logger");
+    config.level = levelFromString(s.value("level").toString(), config.level);
+    if (s.contains("types")) {
+        config.types.clear();
+        foreach (const QString &type, s.value("types").toStringList()) {
+            QString t = type.trimmed();
+            if (!t.isEmpty()) {
+                config.types.insert(t);
+            }
+        }
+    }
+    s.endGroup();
+
+    config.tagLevels.clear();
+    s.beginGroup("tags");
+    foreach (const QString &tag, s.childKeys()) {
+        config.tagLevels.insert(tag, levelFromString(s.value(tag).toString(), config.level));
+    }
+    s.endGroup();
+
+    hasDests = false;
+    QStringList groups = s.childGroups();
+
+    if (groups.contains("console")) {
+        hasDests = true;
+        s.beginGroup("console");
+        dests << new ConsoleLogDest(LogLayout(stringValue(s, "layout", DEFAULT_CONSOLE_LAYOUT)));
+        s.endGroup();
+    }
+
+    if (groups.contains("file")) {
+        hasDests = true;
+        s.beginGroup("file");
+        QString path = s.value("path").toString();
+        if (!path.isEmpty()) {
+            dests << new FileLogDest(path,
+                                     s.value("name", "app").toString(),
+                                     s.value("ext", "log").toString(),
+                                     LogLayout(stringValue(s, "layout", DEFAULT_FILE_LAYOUT)));
+        }
+        s.endGroup();
+    }
+
+    return true;
+}
+
+Logger::Level LogConfigWatcher::levelFromString(const QString &str, Logger::Level def)
+{
+    QString l = str.trimmed().toLower();
+    if (l == "off") {
+        return Logger::Off;
+    } else if (l == "normal") {
+        return Logger::Normal;
+    } else if (l == "debug") {
+        return Logger::Debug;
+    } else if (l == "full") {
+        return Logger::Full;
+    }
+    return def;
+}
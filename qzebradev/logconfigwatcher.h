@@ -0,0 +1,62 @@
+#ifndef QZebraDev_LOGCONFIGWATCHER_H
+#define QZebraDev_LOGCONFIGWATCHER_H
+
+#include <QString>
+#include <QList>
+#include "logger.h"
+
+namespace QZebraDev {
+
+/**
+ * @brief Watches a logger config file and applies it on change, without restart
+ *
+ * Changes are watched by inotify in own thread (only Linux).
+ * Levels, types and tag levels are published to the Logger as one config snapshot,
+ * destinations are replaced if the file has section for them.
+ *
+ * Config file (ini):
+ *
+ * [logger]
+ * level=Debug                      ; Off, Normal, Debug, Full
+ * types=ERROR, WARN, INFO, DEBUG
+ *
+ * [tags]
+ * MyClass=Full                     ; tag
+ * Network*=Debug                   ; tag prefix
+ *
+ * [console]
+ * layout="${time} | ${type|5} | ${tag|26} | ${thread} | ${message}"
+ *
+ * [file]
+ * path=/var/log/myapp
+ * name=myapp
+ * ext=log
+ * layout="${datetime} | ${type|5} | ${tag|26} | ${thread} | ${message}"
+ */
+class LogConfigWatcher
+{
+public:
+    explicit LogConfigWatcher(const QString &filePath);
+    ~LogConfigWatcher();
+
+    QString filePath() const;
+
+    bool start(); //! NOTE Applies the file and starts watching
+    void stop();
+    bool isRunning() const;
+
+    static bool apply(const QString &filePath);
+    static bool parse(const QString &filePath, Logger::Config &config, QList<LogDest *> &dests, bool &hasDests);
+
+    static Logger::Level levelFromString(const QString &str, Logger::Level def);
+
+private:
+    class WatchThread;
+
+    QString m_filePath;
+    WatchThread *m_thread;
+};
+
+}
+
+#endif // QZebraDev_LOGCONFIGWATCHER_H
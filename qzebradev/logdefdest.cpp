@@ -2,6 +2,10 @@
 #include <QDir>
 #include <QTextCodec>
 
+#include "logmappedfile.h"
+#include "logindex.h"
+#include "logcodec.h"
+
 using namespace QZebraDev;
 
 MemLogDest::MemLogDest(const LogLayout &l)
@@ -27,16 +31,37 @@ QString MemLogDest::content() const
 }
 
 // FileLogDest
-FileLogDest::FileLogDest(const QString &path, const QString &name, const QString &ext, const LogLayout &l)
-    : LogDest(l), m_path(path), m_name(name), m_ext(ext), m_stream(&m_file)
+FileLogDest::FileLogDest(const QString &path, const QString &name, const QString &ext, const LogLayout &l, const Options &opt)
+    : LogDest(l), m_options(opt), m_mappedFile(0), m_index(0), m_path(path), m_name(name), m_ext(ext), m_stream(&m_file),
+      m_rotateBeginTicks(0), m_rotateEndTicks(0), m_rotateClockGeneration(-1)
 {
+    if (m_options.compressed) {
+        m_block.reserve(m_options.compressBlockSize + 1024);
+    } else if (m_options.mapped) {
+        m_mappedFile = new LogMappedFile(m_options.mappedChunkSize, m_options.mappedWindowSize, m_options.msyncIntervalMs);
+    }
+
+    if (m_options.indexed) {
+        m_index = new LogIndexWriter(m_options.indexBlockSize);
+    }
+
     rotate();
 }
 
 FileLogDest::~FileLogDest()
 {
+    writeFrame();
+
     if (m_file.isOpen())
         m_file.close();
+
+    delete m_mappedFile;
+    delete m_index;
+}
+
+QString FileLogDest::fileName() const
+{
+    return m_file.fileName();
 }
 
 QString FileLogDest::name() const
@@ -46,18 +71,108 @@ QString FileLogDest::name() const
 
 void FileLogDest::write(const LogMsg &logMsg)
 {
-    if (m_rotateDate != logMsg.dateTime.date())
+    //! NOTE By write time, not by message time, a message can be written after the day of it (async writer)
+    if (LogClock::generation() != m_rotateClockGeneration)
+        updateRotateBounds();
+
+    qint64 now = LogClock::ticks();
+    if (now < m_rotateBeginTicks || now >= m_rotateEndTicks)
         rotate();
 
+    if (m_options.compressed) {
+        if (m_block.isEmpty()) {
+            m_blockTimer.start();
+        }
+
+        m_block.append(m_layout.output(logMsg).toUtf8()).append("\r\n");
+        if (m_index) {
+            m_index->addRecord(logMsg.msecsSinceEpoch(), logMsg.type, logMsg.tag);
+        }
+
+        if (m_block.size() >= m_options.compressBlockSize || m_blockTimer.elapsed() >= m_options.compressFlushIntervalMs) {
+            writeFrame();
+        }
+        return;
+    }
+
+    if (m_mappedFile) {
+        QByteArray data = m_layout.output(logMsg).toUtf8();
+        data.append("\r\n");
+        qint64 offset = m_mappedFile->append(data.constData(), data.size());
+        if (m_index && offset >= 0) {
+            m_index->add(offset, data.size(), logMsg.msecsSinceEpoch(), logMsg.type, logMsg.tag);
+        }
+        return;
+    }
+
+    qint64 offset = m_index ? m_file.size() : 0;
+
     m_stream << m_layout.output(logMsg) << "\r\n";
     m_stream.flush();
+
+    if (m_index) {
+        m_index->add(offset, m_file.size() - offset, logMsg.msecsSinceEpoch(), logMsg.type, logMsg.tag);
+    }
+}
+
+void FileLogDest::flush()
+{
+    writeFrame();
+}
+
+bool FileLogDest::idle(bool async)
+{
+    if (m_block.isEmpty()) {
+        return false;
+    }
+
+    //! NOTE In async mode the writer is idle often, so not to write tiny frames, the block is kept until it is filled or aged
+    if (async && m_block.size() < m_options.compressBlockSize / 4 && m_blockTimer.elapsed() < m_options.compressFlushIntervalMs) {
+        return true;
+    }
+
+    writeFrame();
+    return false;
+}
+
+void FileLogDest::writeFrame()
+{
+    if (m_block.isEmpty() || !m_file.isOpen()) {
+        return;
+    }
+
+    QByteArray frame = LogCodec::frame(m_block.constData(), m_block.size());
+    m_block.resize(0); //! NOTE Capacity is reserved
+
+    qint64 offset = m_file.size();
+    m_file.write(frame);
+    m_file.flush();
+
+    if (m_index) {
+        m_index->addFrame(offset, frame.size());
+    }
+}
+
+void FileLogDest::updateRotateBounds()
+{
+    m_rotateClockGeneration = LogClock::generation(); //! NOTE Before conversion, if calibration is changed meanwhile, it is recalculated again
+    m_rotateBeginTicks = LogClock::fromMSecsSinceEpoch(QDateTime(m_rotateDate, QTime(0, 0)).toMSecsSinceEpoch());
+    m_rotateEndTicks = LogClock::fromMSecsSinceEpoch(QDateTime(m_rotateDate.addDays(1), QTime(0, 0)).toMSecsSinceEpoch());
 }
 
 void FileLogDest::rotate()
 {
+    writeFrame();
+
     if (m_file.isOpen())
         m_file.close();
 
+    if (m_mappedFile)
+        m_mappedFile->close();
+
+    if (m_index)
+        m_index->close();
+
     QDir dir(m_path);
     if (!dir.exists() && !dir.mkpath(m_path)) {
         fprintf(stderr, "Debug: FileLogDest can not mkpath %s\n", qPrintable(m_path));
@@ -66,8 +181,21 @@ void FileLogDest::rotate()
     }
 
     m_rotateDate = QDate::currentDate();
+    updateRotateBounds();
     QString fileName = QString("%1/%2-%3.%4").arg(m_path).arg(m_name).arg(m_rotateDate.toString("yyMMdd")).arg(m_ext);
     m_file.setFileName(fileName);
+
+    if (m_index)
+        m_index->open(LogIndexWriter::indexPath(fileName));
+
+    if (m_mappedFile) {
+        if (!m_mappedFile->open(fileName)) {
+            fprintf(stderr, "Debug: FileLogDest can not open mapped %s\n", qPrintable(fileName));
+            fflush(stderr);
+        }
+        return;
+    }
+
     if (!m_file.open(QFile::Append)) {
         fprintf(stderr, "Debug: FileLogDest can not open %s\n", qPrintable(fileName));
         fflush(stderr);
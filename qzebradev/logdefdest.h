@@ -4,6 +4,7 @@
 #include "logger.h"
 #include <QFile>
 #include <QTextStream>
+#include <QElapsedTimer>
 
 namespace QZebraDev
 {
@@ -23,24 +24,57 @@ private:
     QString m_str;
 };
 
+class LogMappedFile;
+class LogIndexWriter;
 class FileLogDest : public LogDest
 {
 public:
-    FileLogDest(const QString &path, const QString &name, const QString &ext, const LogLayout &l);
+
+    struct Options {
+        bool mapped;            //! NOTE Write by memcpy to mapped file (see LogMappedFile), Linux/Unix only
+        int mappedChunkSize;    //! NOTE Preallocate by chunk
+        int mappedWindowSize;
+        int msyncIntervalMs;
+        bool indexed;           //! NOTE Write companion index <file>.idx (see LogIndexWriter, tools/logquery)
+        int indexBlockSize;
+        bool compressed;        //! NOTE Write compressed frames (see LogCodec), mapped is ignored
+        int compressBlockSize;  //! NOTE Frame is written when block is full, or on flush, or after each message in sync mode
+        int compressFlushIntervalMs; //! NOTE Or when block is older, async writer idle writes only such, or at least quarter full block
+
+        Options() : mapped(false), mappedChunkSize(16 * 1024 * 1024), mappedWindowSize(64 * 1024 * 1024),
+            msyncIntervalMs(1000), indexed(false), indexBlockSize(64 * 1024),
+            compressed(false), compressBlockSize(64 * 1024), compressFlushIntervalMs(1000) {}
+    };
+
+    FileLogDest(const QString &path, const QString &name, const QString &ext, const LogLayout &l, const Options &opt = Options());
     ~FileLogDest();
 
     QString name() const;
     void write(const LogMsg &logMsg);
+    void flush();
+    bool idle(bool async);
+
+    QString fileName() const;
 
 private:
     void rotate();
+    void updateRotateBounds();
+    void writeFrame();
 
+    Options m_options;
     QFile m_file;
+    LogMappedFile *m_mappedFile;
+    LogIndexWriter *m_index;
     QString m_path;
     QString m_name;
     QString m_ext;
     QTextStream m_stream;
     QDate m_rotateDate;
+    qint64 m_rotateBeginTicks; //! NOTE Bounds of the day in ticks, not to calculate date on every write
+    qint64 m_rotateEndTicks;
+    int m_rotateClockGeneration; //! NOTE Bounds are recalculated if wall clock is changed (see LogClock::generation)
+    QByteArray m_block;
+    QElapsedTimer m_blockTimer;
 };
 
 class ConsoleLogDest : public LogDest
@@ -1,5 +1,9 @@
 #include "logger.h"
 #include <QCoreApplication>
+#include <QWaitCondition>
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+#include <QLoggingCategory>
+#endif
 
 #include "logdefdest.h"
 
@@ -14,6 +18,9 @@ static const QString TAG_PATTERN("${tag}");
 static const QString THREAD_PATTERN("${thread}");
 static const QString MESSAGE_PATTERN("${message}");
 static const QString TRIMMESSAGE_PATTERN("${trimmessage}");
+static const QString FILE_PATTERN("${file}");
+static const QString LINE_PATTERN("${line}");
+static const QString FUNC_PATTERN("${func}");
 
 static const QChar ZERO('0');
 static const QChar COLON(':');
@@ -47,7 +54,8 @@ QList<LogLayout::Pattern> LogLayout::patterns(const QString &format)
     QStringList ps;
     ps << DATETIME_PATTERN << TIME_PATTERN << TYPE_PATTERN
        << TAG_PATTERN << THREAD_PATTERN << MESSAGE_PATTERN
-       << TRIMMESSAGE_PATTERN;
+       << TRIMMESSAGE_PATTERN << FILE_PATTERN << LINE_PATTERN
+       << FUNC_PATTERN;
 
     QList<LogLayout::Pattern> patterns;
     foreach (const QString &pstr, ps) {
@@ -118,7 +126,8 @@ QString LogLayout::output(const LogMsg &logMsg) const
     QString str;
     str.reserve(100);
     foreach (const Pattern &p, m_patterns) {
-        str.append(p.beforeStr).append(formatPattern(logMsg, p));
+        str.append(p.beforeStr);
+        str.append(formatPattern(logMsg, p));
     }
 
     return str;
@@ -128,11 +137,11 @@ QString LogLayout::formatPattern(const LogMsg &logMsg, const Pattern &p) const
 {
     if (DATETIME_PATTERN == p.pattern) {
 
-        return formatDateTime(logMsg.dateTime).leftJustified(p.minWidth, SPACE);
+        return formatDateTime(logMsg.dateTime()).leftJustified(p.minWidth, SPACE);
 
     } else if (TIME_PATTERN == p.pattern) {
 
-        return formatTime(logMsg.dateTime.time()).leftJustified(p.minWidth, SPACE);
+        return formatTime(logMsg.dateTime().time()).leftJustified(p.minWidth, SPACE);
 
     } else if (TYPE_PATTERN == p.pattern) {
 
@@ -153,6 +162,18 @@ QString LogLayout::formatPattern(const LogMsg &logMsg, const Pattern &p) const
     } else if (TRIMMESSAGE_PATTERN == p.pattern) {
 
         return logMsg.message.simplified().remove(QChar('"')).replace("\\", "\\\\").leftJustified(p.minWidth, SPACE);
+
+    } else if (FILE_PATTERN == p.pattern) {
+
+        return QString::fromLatin1(logMsg.file).leftJustified(p.minWidth, SPACE);
+
+    } else if (LINE_PATTERN == p.pattern) {
+
+        return QString::number(logMsg.line).leftJustified(p.minWidth, SPACE);
+
+    } else if (FUNC_PATTERN == p.pattern) {
+
+        return QString::fromLatin1(logMsg.func).leftJustified(p.minWidth, SPACE);
     }
 
     return QString();
@@ -236,21 +257,155 @@ LogDest::LogDest(const LogLayout &l) : m_layout(l)
 LogDest::~LogDest()
 {}
 
+void LogDest::flush()
+{}
+
+bool LogDest::idle(bool async)
+{
+    if (async) {
+        flush();
+    }
+    return false;
+}
+
 LogLayout LogDest::layout() const
 {
     return m_layout;
 }
 
+// LogSite --------------------------------
+
+bool LogSite::resolve(Logger::Level level, const QString &tag)
+{
+    //! NOTE Generation is read before config, if config is changed during resolve, the state will be stale
+    int gen = Logger::s_generation.loadAcquire();
+    Logger::Level tagLevel = Logger::instance()->tagLevel(tag);
+    if (gen != LAST_GENERATION) {
+        state.store((gen << 2) | tagLevel);
+    }
+    return level <= tagLevel && level != Logger::Off;
+}
+
 // Logger ---------------------------------
 Logger *Logger::s_logger = 0;
+QBasicAtomicInt Logger::s_generation = Q_BASIC_ATOMIC_INITIALIZER(1);
 const QString Logger::ERROR("ERROR");
 const QString Logger::WARN("WARN");
 const QString Logger::INFO("INFO");
 const QString Logger::DEBUG("DEBUG");
 
+//! NOTE Writes messages to destinations in background thread
+static const unsigned long ASYNC_IDLE_FLUSH_MS = 100;
+
+class Logger::AsyncWriter : public QThread
+{
+public:
+    explicit AsyncWriter(Logger *logger)
+        : m_logger(logger), m_stop(false), m_pushed(0), m_written(0) {}
+
+    void push(const LogMsg &logMsg)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue.append(logMsg);
+        ++m_pushed;
+        m_wait.wakeOne();
+    }
+
+    void flush()
+    {
+        QMutexLocker locker(&m_mutex);
+        while (m_written < m_pushed && isRunning()) {
+            m_flushed.wait(&m_mutex);
+        }
+    }
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wait.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        QList<LogMsg> queue;
+        bool dirty = false; //! NOTE Something written after last flush
+        forever {
+            bool idle = false;
+            {
+                QMutexLocker locker(&m_mutex);
+                m_written += queue.count();
+                queue.clear();
+                m_flushed.wakeAll();
+
+                if (m_queue.isEmpty() && !m_stop) {
+                    idle = !m_wait.wait(&m_mutex, ASYNC_IDLE_FLUSH_MS);
+                }
+
+                if (m_queue.isEmpty() && m_stop) { //! NOTE Stopped and all written
+                    return;
+                }
+
+                queue.swap(m_queue);
+            }
+
+            foreach (const LogMsg &logMsg, queue) {
+                m_logger->writeToDests(logMsg, true);
+                dirty = true;
+            }
+
+            if (idle && dirty) {
+                dirty = m_logger->idleDests(); //! NOTE Let dests write buffered data
+            }
+        }
+    }
+
+private:
+    Logger *m_logger;
+    QMutex m_mutex;
+    QWaitCondition m_wait;
+    QWaitCondition m_flushed;
+    QList<LogMsg> m_queue;
+    bool m_stop;
+    quint64 m_pushed;
+    quint64 m_written;
+};
+
+//! NOTE Enabled Qt message types (bit per QtMsgType), used by category filter and message handler
+static QBasicAtomicInt s_qtMsgEnabled = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+static inline bool isQtMsgEnabled(QtMsgType type)
+{
+    return s_qtMsgEnabled.load() & (1 << type);
+}
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+static QLoggingCategory::CategoryFilter s_prevCategoryFilter = 0;
+
+//! NOTE Disabled categories are filtered in qCDebug/qDebug... macros, so messages never reach the handler
+static void qtCategoryFilter(QLoggingCategory *category)
+{
+    if (s_prevCategoryFilter) {
+        s_prevCategoryFilter(category); //! NOTE Qt rules (QT_LOGGING_RULES, setFilterRules)
+    }
+
+    category->setEnabled(QtDebugMsg, category->isDebugEnabled() && isQtMsgEnabled(QtDebugMsg));
+    category->setEnabled(QtWarningMsg, category->isWarningEnabled() && isQtMsgEnabled(QtWarningMsg));
+    category->setEnabled(QtCriticalMsg, category->isCriticalEnabled() && isQtMsgEnabled(QtCriticalMsg));
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+    category->setEnabled(QtInfoMsg, category->isInfoEnabled() && isQtMsgEnabled(QtInfoMsg));
+#endif
+}
+#endif
+
 Logger::Logger()
-    : m_level(Normal)
+    : m_config(new Config()), m_asyncLock(QReadWriteLock::Recursive), m_asyncWriter(0)
 {
+    LogClock::startCalibration();
     setupDefault();
 }
 
@@ -258,40 +413,156 @@ Logger::~Logger()
 {
     Logger::s_logger = 0;
     setIsCatchQtMsg(false);
+    setIsAsync(false);
     clearDests();
+    LogClock::stopCalibration();
+
+    delete m_config.loadAcquire();
+    qDeleteAll(m_retiredConfigs);
 }
 
 void Logger::setupDefault()
 {
+    setIsAsync(false);
+
     clearDests();
     addDest(new ConsoleLogDest(LogLayout("${time} | ${type|5} | ${tag|26} | ${thread} | ${message}")));
 
-    m_level = Normal;
-
-    m_types.clear();
-    m_types << ERROR << WARN << INFO << DEBUG;
+    Config config;
+    config.level = Normal;
+    config.types << ERROR << WARN << INFO << DEBUG;
+    setConfig(config);
 
     setIsCatchQtMsg(true);
+    updateQtMsgFilter();
+}
+
+Logger::Config Logger::config() const
+{
+    return *m_config.loadAcquire();
+}
+
+void Logger::setConfig(const Config &config)
+{
+    QMutexLocker locker(&m_configMutex);
+    publishConfig(new Config(config));
+}
+
+//! NOTE Must be called under m_configMutex
+void Logger::publishConfig(Config *config)
+{
+    Config *old = m_config.fetchAndStoreOrdered(config);
+
+    //! NOTE Readers can still use old config at any time, there is no reference or epoch, so it is not deleted
+    m_retiredConfigs.append(old);
+
+    //! NOTE After config publish, so call sites resolved with new generation see new config (under config mutex)
+    int gen = s_generation.load();
+    if (gen < LogSite::LAST_GENERATION) {
+        s_generation.fetchAndStoreOrdered(gen + 1);
+    }
+
+    updateQtMsgFilter();
 }
 
 void Logger::write(const LogMsg &logMsg)
+{
+    {
+        QReadLocker locker(&m_asyncLock);
+        if (m_asyncWriter) {
+            m_asyncWriter->push(logMsg);
+            return;
+        }
+    }
+
+    writeToDests(logMsg, false);
+}
+
+void Logger::writeToDests(const LogMsg &logMsg, bool async)
 {
     QMutexLocker locker(&m_mutex);
     if (isAsseptMsg(logMsg.type)) {
         foreach (LogDest *dest, m_dests) {
             dest->write(logMsg);
+            if (!async) {
+                dest->idle(false);
+            }
         }
     }
 }
 
+void Logger::flushDests()
+{
+    QMutexLocker locker(&m_mutex);
+    foreach (LogDest *dest, m_dests) {
+        dest->flush();
+    }
+}
+
+bool Logger::idleDests()
+{
+    QMutexLocker locker(&m_mutex);
+    bool buffered = false;
+    foreach (LogDest *dest, m_dests) {
+        buffered = dest->idle(true) || buffered;
+    }
+    return buffered;
+}
+
+void Logger::setIsAsync(bool arg)
+{
+    if (arg == isAsync()) {
+        return;
+    }
+
+    if (arg) {
+        AsyncWriter *writer = new AsyncWriter(this);
+        writer->start();
+
+        QWriteLocker locker(&m_asyncLock);
+        m_asyncWriter = writer;
+    } else {
+        AsyncWriter *writer = 0;
+        {
+            //! NOTE After it no one pushes to the writer, so it can be stopped and deleted
+            QWriteLocker locker(&m_asyncLock);
+            writer = m_asyncWriter;
+            m_asyncWriter = 0;
+        }
+
+        if (writer) {
+            writer->stop();
+            delete writer;
+        }
+    }
+}
+
+bool Logger::isAsync() const
+{
+    QReadLocker locker(&m_asyncLock);
+    return m_asyncWriter != 0;
+}
+
+void Logger::flush()
+{
+    {
+        QReadLocker locker(&m_asyncLock);
+        if (m_asyncWriter) {
+            m_asyncWriter->flush();
+        }
+    }
+    flushDests();
+}
+
 bool Logger::isAsseptMsg(const QString &type) const
 {
-    return m_level == Full || m_level == Normal || isType(type);
+    const Config *config = m_config.loadAcquire();
+    return config->level == Full || config->level == Normal || config->types.contains(type);
 }
 
 bool Logger::isType(const QString &type) const
 {
-    return m_types.contains(type);
+    return m_config.loadAcquire()->types.contains(type);
 }
 
 void Logger::addDest(LogDest *dest)
@@ -311,55 +582,164 @@ void Logger::clearDests()
     m_dests.clear();
 }
 
+void Logger::setDests(const QList<LogDest *> &dests)
+{
+    QList<LogDest *> old;
+    {
+        QMutexLocker locker(&m_mutex);
+        old = m_dests;
+        m_dests = dests;
+    }
+    qDeleteAll(old);
+}
+
 void Logger::setLevel(const Level level)
 {
-    m_level = level;
+    QMutexLocker locker(&m_configMutex);
+    Config *config = new Config(*m_config.loadAcquire());
+    config->level = level;
+    publishConfig(config);
 }
 
 Logger::Level Logger::level() const
 {
-    return m_level;
+    return m_config.loadAcquire()->level;
+}
+
+void Logger::setTagLevel(const QString &tag, Level level)
+{
+    QMutexLocker locker(&m_configMutex);
+    Config *config = new Config(*m_config.loadAcquire());
+    config->tagLevels.insert(tag, level);
+    publishConfig(config);
+}
+
+void Logger::removeTagLevel(const QString &tag)
+{
+    QMutexLocker locker(&m_configMutex);
+    Config *config = new Config(*m_config.loadAcquire());
+    config->tagLevels.remove(tag);
+    publishConfig(config);
+}
+
+//! NOTE Exact tag first, then the longest matched prefix ("Net*"), otherwise global level
+Logger::Level Logger::tagLevel(const QString &tag) const
+{
+    static const QChar ASTERISK('*');
+
+    const Config *config = m_config.loadAcquire();
+    if (config->tagLevels.isEmpty()) {
+        return config->level;
+    }
+
+    QHash<QString, Level>::ConstIterator exact = config->tagLevels.constFind(tag);
+    if (exact != config->tagLevels.constEnd()) {
+        return exact.value();
+    }
+
+    Level level = config->level;
+    int prefixLen = -1;
+    QHash<QString, Level>::ConstIterator it = config->tagLevels.constBegin(), end = config->tagLevels.constEnd();
+    for (; it != end; ++it) {
+        const QString &key = it.key();
+        if (!key.endsWith(ASTERISK)) {
+            continue;
+        }
+
+        int len = key.count() - 1;
+        if (len > prefixLen && tag.startsWith(key.leftRef(len))) {
+            prefixLen = len;
+            level = it.value();
+        }
+    }
+
+    return level;
 }
 
 QSet<QString> Logger::types() const
 {
-    return m_types;
+    return m_config.loadAcquire()->types;
 }
 
 void Logger::setTypes(const QSet<QString> &types)
 {
-    m_types = types;
+    QMutexLocker locker(&m_configMutex);
+    Config *config = new Config(*m_config.loadAcquire());
+    config->types = types;
+    publishConfig(config);
 }
 
 void Logger::setType(const QString &type, bool enb)
 {
+    QMutexLocker locker(&m_configMutex);
+    Config *config = new Config(*m_config.loadAcquire());
     if (enb) {
-        if (!m_types.contains(type)) {
-            m_types.insert(type);
-        }
+        config->types.insert(type);
     } else {
-        m_types.remove(type);
+        config->types.remove(type);
     }
+    publishConfig(config);
+}
+
+void Logger::updateQtMsgFilter()
+{
+    int enabled = (1 << QtFatalMsg);
+    if (isLevel(Normal)) {
+        if (isAsseptMsg(ERROR)) {
+            enabled |= (1 << QtCriticalMsg);
+        }
+        if (isAsseptMsg(WARN)) {
+            enabled |= (1 << QtWarningMsg);
+        }
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+        if (isAsseptMsg(INFO)) {
+            enabled |= (1 << QtInfoMsg);
+        }
+#endif
+    }
+
+    if (isLevel(Debug) && isAsseptMsg(DEBUG)) {
+        enabled |= (1 << QtDebugMsg);
+    }
+
+    s_qtMsgEnabled.store(enabled);
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+    if (s_prevCategoryFilter) {
+        QLoggingCategory::installFilter(qtCategoryFilter); //! NOTE Reapply filter to all categories
+    }
+#endif
 }
 
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
 void Logger::logMsgHandler(QtMsgType type, const QMessageLogContext &context, const QString &s)
 {
-    Q_UNUSED(context);
 #else
 void Logger::logMsgHandler(enum QtMsgType type, const char *s)
 {
 #endif
-    if (type == QtDebugMsg && !Logger::instance()->isLevel(Logger::Debug)) {
+    if (!isQtMsgEnabled(type)) {
         return;
     }
 
     static const QString Qt("Qt");
 
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+    //! NOTE Context pointers are static for C++ (__FILE__, Q_FUNC_INFO), but QML passes temporaries,
+    //! so they are copied, the message can be queued to the async writer
+    LogMsg logMsg(qtMsgTypeToString(type), Qt, context.file, context.line, context.function);
+    logMsg.copyLocation();
+    logMsg.message = s;
+#else
     LogMsg logMsg(qtMsgTypeToString(type), Qt, QString(s));
+#endif
 
     Logger::instance()->write(logMsg);
+
+    if (type == QtFatalMsg) {
+        Logger::instance()->flush(); //! NOTE Application will be aborted after return
+    }
 }
 
 QString Logger::qtMsgTypeToString(enum QtMsgType defType)
@@ -375,6 +755,15 @@ QString Logger::qtMsgTypeToString(enum QtMsgType defType)
 
 void Logger::setIsCatchQtMsg(bool arg)
 {
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+    if (arg && !s_prevCategoryFilter) {
+        s_prevCategoryFilter = QLoggingCategory::installFilter(qtCategoryFilter);
+    } else if (!arg && s_prevCategoryFilter) {
+        QLoggingCategory::installFilter(s_prevCategoryFilter);
+        s_prevCategoryFilter = 0;
+    }
+#endif
+
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
     QtMessageHandler h = arg ? logMsgHandler : 0;
     qInstallMessageHandler(h);
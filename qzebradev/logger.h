@@ -4,8 +4,15 @@
 #include <QDebug>
 #include <QList>
 #include <QMutex>
+#include <QReadWriteLock>
 #include <QThread>
 #include <QDateTime>
+#include <QByteArray>
+#include <QSet>
+#include <QHash>
+#include <QAtomicPointer>
+
+#include "logclock.h"
 
 namespace QZebraDev {
 
@@ -14,21 +21,45 @@ class LogMsg
 {
 public:
 
-    LogMsg() : thread(0) {}
+    LogMsg() : ticks(0), thread(0), file(0), line(0), func(0) {}
     
     LogMsg(const QString &l, const QString &t)
-        : type(l), tag(t), dateTime(QDateTime::currentDateTime()),
-          thread(QThread::currentThread()) {}
+        : type(l), tag(t), ticks(LogClock::ticks()),
+          thread(QThread::currentThread()), file(0), line(0), func(0) {}
     
     LogMsg(const QString &l, const QString &t, const QString &m)
-        : type(l), tag(t), message(m), dateTime(QDateTime::currentDateTime()),
-          thread(QThread::currentThread()) {}
+        : type(l), tag(t), message(m), ticks(LogClock::ticks()),
+          thread(QThread::currentThread()), file(0), line(0), func(0) {}
+
+    LogMsg(const QString &l, const QString &t, const char *fl, int ln, const char *fn)
+        : type(l), tag(t), ticks(LogClock::ticks()),
+          thread(QThread::currentThread()), file(fl), line(ln), func(fn) {}
+
+    //! NOTE Wall time is calculated from ticks (see LogClock), only when it is needed
+    QDateTime dateTime() const { return LogClock::toDateTime(ticks); }
+    qint64 msecsSinceEpoch() const { return LogClock::toMSecsSinceEpoch(ticks); }
+    void setDateTime(const QDateTime &dt) { ticks = LogClock::fromMSecsSinceEpoch(dt.toMSecsSinceEpoch()); }
     
     QString type;
     QString tag;
     QString message;
-    QDateTime dateTime;
+    qint64 ticks;
     QThread *thread;
+
+    //! NOTE Copies source location into the message, if strings are not static and the message can outlive them
+    void copyLocation()
+    {
+        QByteArray fl(file), fn(func);
+        location = fl + '\0' + fn;
+        file = file ? location.constData() : 0;
+        func = func ? location.constData() + fl.size() + 1 : 0;
+    }
+
+    //! NOTE Source location, pointers to static strings (__FILE__, Q_FUNC_INFO), not copied (see copyLocation)
+    const char *file;
+    int line;
+    const char *func;
+    QByteArray location;
 };
 
 //! Layout ---------------------------------
@@ -75,6 +106,11 @@ public:
     
     virtual QString name() const = 0;
     virtual void write(const LogMsg &logMsg) = 0;
+    virtual void flush(); //! NOTE Write buffered data, called by Logger::flush
+
+    //! NOTE Called when there are no more messages to write now: after each message in sync mode,
+    //! when async writer is idle (flush by default). Returns true if data is left buffered, then it is called on the next idle
+    virtual bool idle(bool async);
 
     LogLayout layout() const;
     
@@ -108,11 +144,29 @@ public:
     static const QString INFO;
     static const QString DEBUG;
 
+    //! NOTE Immutable snapshot, readers use the published config without lock
+    struct Config {
+        Level level;
+        QSet<QString> types;
+        QHash<QString, Level> tagLevels; //! NOTE Key is a tag or a tag prefix with "*" at the end
+        Config() : level(Normal) {}
+    };
+
     void setupDefault();
+
+    Config config() const;
+    void setConfig(const Config &config);
     
     void setLevel(Level level);
     Level level() const;
-    inline bool isLevel(Level level) const { return level <= m_level && level != Off; }
+    inline bool isLevel(Level level) const { return level <= m_config.loadAcquire()->level && level != Off; }
+
+    void setTagLevel(const QString &tag, Level level);
+    void removeTagLevel(const QString &tag);
+    Level tagLevel(const QString &tag) const;
+
+    //! NOTE Changed on each config publish, invalidates cached levels of call sites (see LogSite)
+    static inline int generation() { return s_generation.load(); }
     
     QSet<QString> types() const;
     void setTypes(const QSet<QString> &types);
@@ -123,16 +177,23 @@ public:
 
     static void setIsCatchQtMsg(bool arg);
 
+    void setIsAsync(bool arg);
+    bool isAsync() const;
+    void flush(); //! NOTE Waits until all queued messages are written and flushes dests
+
     void write(const LogMsg &logMsg);
     
     void addDest(LogDest *dest);
     QList<LogDest *> dests() const;
     void clearDests();
+    void setDests(const QList<LogDest *> &dests); //! NOTE Replaces and deletes current dests
     
 private:
     Logger();
     ~Logger();
     static Logger *s_logger;
+    static QBasicAtomicInt s_generation;
+    friend struct LogSite;
     
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
     static void logMsgHandler(QtMsgType, const QMessageLogContext &, const QString &);
@@ -142,18 +203,53 @@ private:
     
     static QString qtMsgTypeToString(enum QtMsgType defType);
 
-    Level m_level;
+    void writeToDests(const LogMsg &logMsg, bool async);
+    void flushDests();
+    bool idleDests();
+    void updateQtMsgFilter();
+    void publishConfig(Config *config);
+
+    class AsyncWriter;
+
+    QAtomicPointer<Config> m_config;
+    QList<Config*> m_retiredConfigs; //! NOTE Readers use config without reference, so replaced are deleted with the logger (small, replaced rarely)
+    QMutex m_configMutex;
     QList<LogDest*> m_dests;
-    QSet<QString> m_types;
     QMutex m_mutex;
+    mutable QReadWriteLock m_asyncLock; //! NOTE Writers push under read lock, setIsAsync changes the writer under write lock, recursive (dests can log)
+    AsyncWriter *m_asyncWriter;
+};
+
+//! Call site -----------------------------
+//! NOTE Used as static slot in each log call site (see IF_LOGLEVEL_TAG in log.h),
+//! the tag level is resolved once and cached until the config generation changes
+struct LogSite
+{
+    QBasicAtomicInt state; //! NOTE (generation << 2) | level, 0 - not resolved
+
+    //! NOTE Generation is not wrapped (a stale site would match a reused generation), it stops at the last,
+    //! with it the level is not cached, so sites resolve each time
+    static const int LAST_GENERATION = 0x1FFFFFFF; //! NOTE Should fit in state
+
+    //! NOTE 1 - enabled, 0 - disabled, -1 - need resolve
+    inline int check(Logger::Level level) const {
+        int st = state.load();
+        if ((st >> 2) != Logger::generation()) {
+            return -1;
+        }
+        return (level <= (st & 3) && level != Logger::Off) ? 1 : 0;
+    }
+
+    bool resolve(Logger::Level level, const QString &tag);
 };
 
 //! Stream ---------------------------------
 class LogStream
 {
 public:
-    explicit LogStream(const QString &type, const QString &tag)
-        : m_msg(type, tag), m_stream(&m_msg.message) {}
+    explicit LogStream(const QString &type, const QString &tag,
+                       const char *file = 0, int line = 0, const char *func = 0)
+        : m_msg(type, tag, file, line, func), m_stream(&m_msg.message) {}
     
     ~LogStream() {
 
@@ -0,0 +1,239 @@
+#include "logindex.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace QZebraDev;
+
+static const quint32 INDEX_MAGIC = 0x515A4C49; //! NOTE QZLI
+static const quint32 INDEX_VERSION = 2; //! NOTE 2 - bits by FNV-1a
+static const int INDEX_HEADER_SIZE = 8;
+
+Q_STATIC_ASSERT(sizeof(LogIndexBlock) == 40);
+
+LogIndexWriter::LogIndexWriter(int blockSize)
+    : m_blockSize(blockSize), m_count(0)
+{
+}
+
+LogIndexWriter::~LogIndexWriter()
+{
+    close();
+}
+
+QString LogIndexWriter::indexPath(const QString &logPath)
+{
+    return logPath + ".idx";
+}
+
+//! NOTE Persisted in index files, so the hash must not depend on Qt version or seed
+quint32 LogIndexWriter::bit(const QString &str)
+{
+    quint32 hash = 2166136261u;
+    const QByteArray utf8 = str.toUtf8();
+    for (int i = 0; i < utf8.size(); ++i) {
+        hash ^= static_cast<quint8>(utf8.at(i));
+        hash *= 16777619u;
+    }
+    return quint32(1) << (hash % 32);
+}
+
+bool LogIndexWriter::open(const QString &indexPath)
+{
+    close();
+
+    m_file.setFileName(indexPath);
+    if (!m_file.open(QFile::ReadWrite)) {
+        fprintf(stderr, "Debug: LogIndexWriter can not open %s\n", qPrintable(indexPath));
+        fflush(stderr);
+        return false;
+    }
+
+    quint32 header[2] = { 0, 0 };
+    if (m_file.size() >= INDEX_HEADER_SIZE) {
+        m_file.read(reinterpret_cast<char *>(header), sizeof(header));
+    }
+
+    //! NOTE Other version (other bits) is rebuilt from here, blocks of the old are not appended to
+    if (header[0] != INDEX_MAGIC || header[1] != INDEX_VERSION) {
+        header[0] = INDEX_MAGIC;
+        header[1] = INDEX_VERSION;
+        m_file.resize(0);
+        m_file.seek(0);
+        m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    } else {
+        //! NOTE Drop a partially written block (crash)
+        qint64 size = m_file.size() - (m_file.size() - INDEX_HEADER_SIZE) % sizeof(LogIndexBlock);
+        m_file.resize(size);
+    }
+
+    m_file.seek(m_file.size());
+    m_block = LogIndexBlock();
+    m_count = 0;
+    return true;
+}
+
+void LogIndexWriter::close()
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    writeBlock();
+    m_file.close();
+}
+
+bool LogIndexWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void LogIndexWriter::add(qint64 offset, qint64 size, qint64 msecs, const QString &type, const QString &tag)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    //! NOTE Not contiguous (file was changed by other), start new block
+    if (m_count > 0 && m_block.offset + m_block.size != offset) {
+        writeBlock();
+    }
+
+    if (m_count == 0) {
+        m_block.offset = offset;
+    }
+
+    m_block.size += size;
+    addRecord(msecs, type, tag);
+
+    if (m_block.size >= m_blockSize) {
+        writeBlock();
+    }
+}
+
+void LogIndexWriter::addRecord(qint64 msecs, const QString &type, const QString &tag)
+{
+    if (m_count == 0) {
+        m_block.minMsecs = msecs;
+        m_block.maxMsecs = msecs;
+    }
+
+    m_block.minMsecs = qMin(m_block.minMsecs, msecs);
+    m_block.maxMsecs = qMax(m_block.maxMsecs, msecs);
+    m_block.types |= bit(type);
+    m_block.tags |= bit(tag);
+    ++m_count;
+}
+
+void LogIndexWriter::addFrame(qint64 offset, qint64 size)
+{
+    if (!m_file.isOpen() || m_count == 0) {
+        return;
+    }
+
+    m_block.offset = offset;
+    m_block.size = size;
+    writeBlock();
+}
+
+void LogIndexWriter::writeBlock()
+{
+    //! NOTE Records without data (frame was not written) are not indexed
+    if (m_count > 0 && m_block.size > 0) {
+        m_file.write(reinterpret_cast<const char *>(&m_block), sizeof(LogIndexBlock));
+        m_file.flush();
+    }
+
+    m_block = LogIndexBlock();
+    m_count = 0;
+}
+
+// LogIndexReader
+
+LogIndexReader::LogIndexReader()
+{
+}
+
+bool LogIndexReader::open(const QString &indexPath)
+{
+    close();
+
+    QFile file(indexPath);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    if (data.size() < INDEX_HEADER_SIZE) {
+        return false;
+    }
+
+    quint32 header[2];
+    memcpy(header, data.constData(), sizeof(header));
+    if (header[0] != INDEX_MAGIC || header[1] != INDEX_VERSION) {
+        return false;
+    }
+
+    int count = (data.size() - INDEX_HEADER_SIZE) / sizeof(LogIndexBlock);
+    m_blocks.resize(count);
+    if (count > 0) {
+        memcpy(m_blocks.data(), data.constData() + INDEX_HEADER_SIZE, count * sizeof(LogIndexBlock));
+    }
+
+    m_prefixMax.resize(count);
+    m_suffixMin.resize(count);
+    for (int i = 0; i < count; ++i) {
+        m_prefixMax[i] = (i == 0) ? m_blocks.at(i).maxMsecs : qMax(m_prefixMax.at(i - 1), m_blocks.at(i).maxMsecs);
+    }
+    for (int i = count - 1; i >= 0; --i) {
+        m_suffixMin[i] = (i == count - 1) ? m_blocks.at(i).minMsecs : qMin(m_suffixMin.at(i + 1), m_blocks.at(i).minMsecs);
+    }
+
+    return true;
+}
+
+void LogIndexReader::close()
+{
+    m_blocks.clear();
+    m_prefixMax.clear();
+    m_suffixMin.clear();
+}
+
+const QVector<LogIndexBlock> &LogIndexReader::blocks() const
+{
+    return m_blocks;
+}
+
+qint64 LogIndexReader::indexedSize() const
+{
+    if (m_blocks.isEmpty()) {
+        return 0;
+    }
+
+    const LogIndexBlock &last = m_blocks.last();
+    return last.offset + last.size;
+}
+
+QList<LogIndexBlock> LogIndexReader::find(qint64 fromMsecs, qint64 toMsecs, quint32 types, quint32 tags) const
+{
+    //! NOTE Time is almost sorted (threads, async), so search by prefix max and suffix min,
+    //! blocks before begin end earlier than from, blocks after end begin later than to
+    int begin = std::lower_bound(m_prefixMax.constBegin(), m_prefixMax.constEnd(), fromMsecs) - m_prefixMax.constBegin();
+    int end = std::upper_bound(m_suffixMin.constBegin(), m_suffixMin.constEnd(), toMsecs) - m_suffixMin.constBegin();
+
+    QList<LogIndexBlock> found;
+    for (int i = begin; i < end; ++i) {
+        const LogIndexBlock &b = m_blocks.at(i);
+        if (b.maxMsecs < fromMsecs || b.minMsecs > toMsecs) {
+            continue;
+        }
+
+        if ((types && !(b.types & types)) || (tags && !(b.tags & tags))) {
+            continue;
+        }
+
+        found.append(b);
+    }
+
+    return found;
+}
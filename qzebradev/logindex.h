@@ -0,0 +1,89 @@
+#ifndef QZebraDev_LOGINDEX_H
+#define QZebraDev_LOGINDEX_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QFile>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Block of log file, entry of index
+ *
+ * Types and tags are bitmaps, bit is FNV-1a(UTF-8 of type or tag) % 32 (stable, unlike qHash),
+ * so a block may be a false positive, but never a false negative.
+ */
+struct LogIndexBlock {
+    qint64 offset;
+    qint64 size;
+    qint64 minMsecs;
+    qint64 maxMsecs;
+    quint32 types;
+    quint32 tags;
+    LogIndexBlock() : offset(0), size(0), minMsecs(0), maxMsecs(0), types(0), tags(0) {}
+};
+
+/**
+ * @brief Writes companion index of log file (<log file>.idx)
+ *
+ * Index file: header (magic, version), then fixed size blocks (LogIndexBlock).
+ * Block is written when its size reaches blockSize or on close.
+ * Data after the last block (not flushed, crash) is not indexed, readers should scan it.
+ * For compressed files (see LogCodec) block is a frame: records are added by addRecord,
+ * then the block is written by addFrame.
+ */
+class LogIndexWriter
+{
+public:
+    explicit LogIndexWriter(int blockSize = 64 * 1024);
+    ~LogIndexWriter();
+
+    bool open(const QString &indexPath);
+    void close();
+    bool isOpen() const;
+
+    void add(qint64 offset, qint64 size, qint64 msecs, const QString &type, const QString &tag);
+
+    void addRecord(qint64 msecs, const QString &type, const QString &tag);
+    void addFrame(qint64 offset, qint64 size);
+
+    static QString indexPath(const QString &logPath);
+    static quint32 bit(const QString &str);
+
+private:
+    void writeBlock();
+
+    int m_blockSize;
+    QFile m_file;
+    LogIndexBlock m_block;
+    int m_count;
+};
+
+/**
+ * @brief Reads companion index of log file and finds blocks by time range, types and tags
+ */
+class LogIndexReader
+{
+public:
+    LogIndexReader();
+
+    bool open(const QString &indexPath);
+    void close();
+
+    const QVector<LogIndexBlock> &blocks() const;
+    qint64 indexedSize() const; //! NOTE End of the last block
+
+    //! NOTE Blocks which may contain records, binary search by time
+    QList<LogIndexBlock> find(qint64 fromMsecs, qint64 toMsecs, quint32 types = 0, quint32 tags = 0) const;
+
+private:
+    QVector<LogIndexBlock> m_blocks;
+    QVector<qint64> m_prefixMax; //! NOTE Max time of blocks [0, i], not decreasing
+    QVector<qint64> m_suffixMin; //! NOTE Min time of blocks [i, n), not decreasing
+};
+
+}
+
+#endif // QZebraDev_LOGINDEX_H
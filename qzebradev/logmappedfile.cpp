@@ -0,0 +1,301 @@
+#include "logmappedfile.h"
+#include <QFile>
+#include <QThread>
+#include <QWaitCondition>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace QZebraDev;
+
+class LogMappedFile::SyncThread : public QThread
+{
+public:
+    SyncThread(LogMappedFile *file, int intervalMs)
+        : m_file(file), m_intervalMs(intervalMs), m_stop(false) {}
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wait.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (!m_stop) {
+                    m_wait.wait(&m_mutex, m_intervalMs);
+                }
+                if (m_stop) {
+                    return;
+                }
+            }
+
+            m_file->sync();
+        }
+    }
+
+private:
+    LogMappedFile *m_file;
+    unsigned long m_intervalMs;
+    bool m_stop;
+    QMutex m_mutex;
+    QWaitCondition m_wait;
+};
+
+static inline qint64 roundUp(qint64 v, qint64 to)
+{
+    return ((v + to - 1) / to) * to;
+}
+
+static qint64 pageSize()
+{
+#if defined(Q_OS_UNIX)
+    static const qint64 size = sysconf(_SC_PAGESIZE);
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+LogMappedFile::LogMappedFile(qint64 chunkSize, qint64 windowSize, int msyncIntervalMs)
+    : m_chunkSize(roundUp(qMax(chunkSize, pageSize()), pageSize())),
+      m_windowSize(roundUp(qMax(windowSize, pageSize()), pageSize())),
+      m_msyncIntervalMs(msyncIntervalMs),
+      m_fd(-1), m_cursor(0), m_allocated(0), m_map(0), m_mapOffset(0), m_mapSize(0),
+      m_syncedOffset(0), m_syncThread(0)
+{
+}
+
+LogMappedFile::~LogMappedFile()
+{
+    close();
+}
+
+bool LogMappedFile::open(const QString &filePath)
+{
+    close();
+
+#if defined(Q_OS_UNIX)
+    QMutexLocker locker(&m_mutex);
+
+    QByteArray path = QFile::encodeName(filePath);
+    m_fd = ::open(path.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        fprintf(stderr, "Debug: LogMappedFile can not open %s, errno: %d\n", path.constData(), errno);
+        fflush(stderr);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) == -1) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    //! NOTE If the process was crashed, the file has preallocated zeros at the end
+    qint64 end = dataEnd(m_fd, st.st_size);
+    if (end != st.st_size && ftruncate(m_fd, end) == -1) {
+        fprintf(stderr, "Debug: LogMappedFile can not truncate %s, errno: %d\n", path.constData(), errno);
+        fflush(stderr);
+    }
+
+    m_cursor = end;
+    m_allocated = end;
+    m_syncedOffset = end;
+
+    if (m_msyncIntervalMs > 0) {
+        m_syncThread = new SyncThread(this, m_msyncIntervalMs);
+        m_syncThread->start();
+    }
+
+    return true;
+#else
+    Q_UNUSED(filePath);
+    return false;
+#endif
+}
+
+void LogMappedFile::close()
+{
+    if (m_syncThread) {
+        m_syncThread->stop();
+        delete m_syncThread;
+        m_syncThread = 0;
+    }
+
+#if defined(Q_OS_UNIX)
+    QMutexLocker locker(&m_mutex);
+    if (m_fd == -1) {
+        return;
+    }
+
+    unmapWindow();
+
+    if (ftruncate(m_fd, m_cursor) == -1) { //! NOTE Remove preallocated space
+        fprintf(stderr, "Debug: LogMappedFile can not truncate, errno: %d\n", errno);
+        fflush(stderr);
+    }
+
+    ::close(m_fd);
+    m_fd = -1;
+#endif
+}
+
+bool LogMappedFile::isOpen() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_fd != -1;
+}
+
+qint64 LogMappedFile::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cursor;
+}
+
+qint64 LogMappedFile::append(const char *data, int size)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_fd == -1 || size <= 0) {
+        return -1;
+    }
+
+    qint64 offset = m_cursor;
+    if (!ensure(offset + size)) {
+        return -1; //! NOTE Cursor is not moved, so there is no hole
+    }
+
+    memcpy(m_map + (offset - m_mapOffset), data, size);
+    m_cursor = offset + size;
+    return offset;
+}
+
+//! NOTE Must be called under m_mutex
+bool LogMappedFile::ensure(qint64 end)
+{
+#if defined(Q_OS_UNIX)
+    if (m_allocated < end) {
+        qint64 newAllocated = roundUp(end, m_chunkSize);
+        int err = posix_fallocate(m_fd, m_allocated, newAllocated - m_allocated);
+        if (err != 0) {
+            fprintf(stderr, "Debug: LogMappedFile can not allocate, errno: %d\n", err);
+            fflush(stderr);
+            return false;
+        }
+        m_allocated = newAllocated;
+    }
+
+    if (m_map && m_cursor >= m_mapOffset && end <= m_mapOffset + m_mapSize) {
+        return true;
+    }
+
+    unmapWindow();
+
+    qint64 offset = m_cursor - (m_cursor % pageSize());
+    qint64 size = qMax(m_windowSize, roundUp(end - offset, pageSize()));
+
+    void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "Debug: LogMappedFile can not map, errno: %d\n", errno);
+        fflush(stderr);
+        return false;
+    }
+
+    m_map = static_cast<char *>(ptr);
+    m_mapOffset = offset;
+    m_mapSize = size;
+    return true;
+#else
+    Q_UNUSED(end);
+    return false;
+#endif
+}
+
+//! NOTE Must be called under m_mutex, syncs written data of the window, so nothing is lost on the window move
+void LogMappedFile::unmapWindow()
+{
+#if defined(Q_OS_UNIX)
+    if (!m_map) {
+        return;
+    }
+
+    syncWindow(m_cursor);
+    munmap(m_map, m_mapSize);
+    m_map = 0;
+    m_mapOffset = 0;
+    m_mapSize = 0;
+#endif
+}
+
+//! NOTE Must be called under m_mutex
+void LogMappedFile::syncWindow(qint64 end)
+{
+#if defined(Q_OS_UNIX)
+    end = qMin(end, m_mapOffset + m_mapSize);
+    qint64 begin = qMax(m_syncedOffset, m_mapOffset);
+    if (!m_map || end <= begin) {
+        return;
+    }
+
+    begin -= (begin - m_mapOffset) % pageSize();
+    if (msync(m_map + (begin - m_mapOffset), end - begin, MS_SYNC) == 0) {
+        m_syncedOffset = end;
+    } else {
+        fprintf(stderr, "Debug: LogMappedFile can not sync, errno: %d\n", errno);
+        fflush(stderr);
+    }
+#else
+    Q_UNUSED(end);
+#endif
+}
+
+void LogMappedFile::sync()
+{
+    QMutexLocker locker(&m_mutex);
+    syncWindow(m_cursor); //! NOTE Only written data, cursor is moved after copy
+}
+
+qint64 LogMappedFile::dataEnd(int fd, qint64 fileSize)
+{
+    qint64 end = fileSize;
+#if defined(Q_OS_UNIX)
+    char buf[4096];
+    while (end > 0) {
+        qint64 n = qMin(end, static_cast<qint64>(sizeof(buf)));
+        if (pread(fd, buf, n, end - n) != n) {
+            break;
+        }
+
+        qint64 i = n;
+        while (i > 0 && buf[i - 1] == 0) {
+            --i;
+        }
+
+        if (i > 0) {
+            end = end - n + i;
+            break;
+        }
+
+        end -= n;
+    }
+#else
+    Q_UNUSED(fd);
+#endif
+    return end;
+}
@@ -0,0 +1,59 @@
+#ifndef QZebraDev_LOGMAPPEDFILE_H
+#define QZebraDev_LOGMAPPEDFILE_H
+
+#include <QString>
+#include <QMutex>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Append-only file, written by memcpy into a mapped window (Linux/Unix)
+ *
+ * The file is preallocated by chunks (fallocate), the window is remapped forward as the file grows.
+ * Appends are serialized by mutex (FileLogDest writes under Logger mutex anyway, so it is not contended),
+ * the cursor is advanced only after data is copied, so a failed append leaves no hole.
+ * Dirty pages are synced (msync) by a background thread, and before the window is unmapped.
+ * On close the file is truncated to the written size.
+ */
+class LogMappedFile
+{
+public:
+    explicit LogMappedFile(qint64 chunkSize = 16 * 1024 * 1024, qint64 windowSize = 64 * 1024 * 1024, int msyncIntervalMs = 1000);
+    ~LogMappedFile();
+
+    bool open(const QString &filePath);
+    void close();
+    bool isOpen() const;
+
+    qint64 append(const char *data, int size); //! NOTE Returns offset of data, or -1
+    qint64 size() const;
+
+    void sync();
+
+private:
+    bool ensure(qint64 end);
+    void syncWindow(qint64 end);
+    void unmapWindow();
+    static qint64 dataEnd(int fd, qint64 fileSize);
+
+    class SyncThread;
+
+    qint64 m_chunkSize;
+    qint64 m_windowSize;
+    int m_msyncIntervalMs;
+
+    int m_fd;
+    qint64 m_cursor;         //! NOTE End of written data
+    qint64 m_allocated;
+    char *m_map;             //! NOTE Current window
+    qint64 m_mapOffset;
+    qint64 m_mapSize;
+    qint64 m_syncedOffset;
+    mutable QMutex m_mutex;
+    SyncThread *m_syncThread;
+};
+
+}
+
+#endif // QZebraDev_LOGMAPPEDFILE_H
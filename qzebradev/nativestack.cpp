@@ -0,0 +1,242 @@
+#include "nativestack.h"
+#include <QMutex>
+#include <QAtomicInt>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#define QZebraDev_NATIVESTACK_SUPPORTED
+#endif
+
+using namespace QZebraDev;
+
+static const int MAX_FRAMES = 64;
+static const int HANDLER_FRAMES = 2; //! NOTE The handler and the signal trampoline
+
+enum RequestState {
+    Idle = 0,
+    Requested,
+    Capturing,
+    Done,
+    Abandoned   //! NOTE The caller did not wait for the handler (blocked in backtrace), the handler resets to Idle
+};
+
+//! NOTE Static, the handler can be late (after timeout), so it is never freed
+struct Request {
+    QAtomicInt state;
+    void *frames[MAX_FRAMES];
+    int count;
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    QAtomicInt target;  //! NOTE Kernel thread id
+    sem_t done;
+#endif
+};
+
+static Request s_request;
+static QAtomicInt s_signo(0);
+static QMutex s_mutex;
+
+bool NativeStack::install(int signo)
+{
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    QMutexLocker locker(&s_mutex);
+    if (s_signo.load() != 0) {
+        return true;
+    }
+
+    if (signo == 0) {
+        signo = SIGRTMIN + 5;
+    }
+
+    //! NOTE The first call of backtrace loads libgcc, it is not async-signal-safe, so not in the handler
+    void *frames[1];
+    backtrace(frames, 1);
+
+    sem_init(&s_request.done, 0, 0);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &NativeStack::handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(signo, &sa, 0) == -1) {
+        fprintf(stderr, "Debug: NativeStack can not install signal handler, errno: %d\n", errno);
+        fflush(stderr);
+        return false;
+    }
+
+    s_signo.storeRelease(signo);
+    return true;
+#else
+    Q_UNUSED(signo);
+    return false;
+#endif
+}
+
+bool NativeStack::isInstalled()
+{
+    return s_signo.loadAcquire() != 0;
+}
+
+int NativeStack::currentThreadId()
+{
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    return static_cast<int>(syscall(SYS_gettid));
+#else
+    return 0;
+#endif
+}
+
+void NativeStack::handler(int signo)
+{
+    Q_UNUSED(signo);
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    int savedErrno = errno;
+
+    //! NOTE Only atomics, gettid, backtrace and sem_post here
+    if (static_cast<int>(syscall(SYS_gettid)) == s_request.target.loadAcquire() && s_request.state.testAndSetAcquire(Requested, Capturing)) {
+        s_request.count = backtrace(s_request.frames, MAX_FRAMES);
+        if (s_request.state.testAndSetRelease(Capturing, Done)) {
+            sem_post(&s_request.done);
+        } else {
+            s_request.state.storeRelease(Idle); //! NOTE Abandoned, nobody waits
+        }
+    }
+
+    errno = savedErrno;
+#endif
+}
+
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+static bool waitDone(int timeoutMs)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeoutMs / 1000;
+    ts.tv_nsec += static_cast<long>(timeoutMs % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    int ret;
+    while ((ret = sem_timedwait(&s_request.done, &ts)) == -1 && errno == EINTR) {}
+    return ret == 0;
+}
+#endif
+
+QVector<void *> NativeStack::capture(int tid, int timeoutMs)
+{
+    QVector<void *> frames;
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    int signo = s_signo.loadAcquire();
+    if (signo == 0 || tid <= 0) {
+        return frames;
+    }
+
+    QMutexLocker locker(&s_mutex);
+
+    //! NOTE The handler of abandoned request can still be running (blocked), the slot is busy
+    if (s_request.state.loadAcquire() != Idle) {
+        return frames;
+    }
+
+    while (sem_trywait(&s_request.done) == 0) {} //! NOTE Posted by a late handler
+
+    s_request.count = 0;
+    s_request.target.storeRelease(tid);
+    s_request.state.storeRelease(Requested);
+
+    //! NOTE Only a thread of this process, ESRCH if it is finished
+    if (syscall(SYS_tgkill, getpid(), tid, signo) != 0) {
+        s_request.state.storeRelease(Idle);
+        return frames;
+    }
+
+    if (!waitDone(timeoutMs)) {
+        //! NOTE Timeout (signal is blocked by the thread), cancel if the handler is not started
+        if (s_request.state.testAndSetOrdered(Requested, Idle)) {
+            return frames;
+        }
+
+        //! NOTE The handler is started, backtrace can be blocked (the lock of the loader), so wait is bounded too
+        if (!waitDone(timeoutMs)) {
+            if (s_request.state.testAndSetOrdered(Capturing, Abandoned)) {
+                fprintf(stderr, "Debug: NativeStack capture of thread %d is abandoned, the handler is blocked\n", tid);
+                fflush(stderr);
+                return frames;
+            }
+
+            waitDone(timeoutMs); //! NOTE Done just now, it is posted
+        }
+    }
+
+    for (int i = HANDLER_FRAMES; i < s_request.count; ++i) {
+        frames.append(s_request.frames[i]);
+    }
+
+    s_request.state.storeRelease(Idle);
+#else
+    Q_UNUSED(tid);
+    Q_UNUSED(timeoutMs);
+#endif
+    return frames;
+}
+
+QStringList NativeStack::symbolize(const QVector<void *> &frames)
+{
+    QStringList lines;
+    for (int i = 0; i < frames.count(); ++i) {
+        quintptr addr = reinterpret_cast<quintptr>(frames.at(i));
+        QString line = QString("#%1 0x%2").arg(i).arg(addr, 0, 16);
+
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+        //! NOTE Names of not exported functions are not available without -rdynamic
+        Dl_info info;
+        if (dladdr(frames.at(i), &info) && info.dli_fname) {
+            if (info.dli_sname) {
+                int status = 0;
+                char *demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+                line += " " + QString::fromLatin1(status == 0 && demangled ? demangled : info.dli_sname);
+                line += QString("+0x%1").arg(addr - reinterpret_cast<quintptr>(info.dli_saddr), 0, 16);
+                free(demangled);
+            }
+            line += QString(" (%1)").arg(QString::fromLocal8Bit(info.dli_fname));
+        }
+#endif
+
+        lines << line;
+    }
+    return lines;
+}
+
+QString NativeStack::symbolName(void *addr)
+{
+#if defined(QZebraDev_NATIVESTACK_SUPPORTED)
+    Dl_info info;
+    if (dladdr(addr, &info) && info.dli_fname) {
+        if (info.dli_sname) {
+            int status = 0;
+            char *demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+            QString name = QString::fromLatin1(status == 0 && demangled ? demangled : info.dli_sname);
+            free(demangled);
+            return name;
+        }
+
+        const char *lib = strrchr(info.dli_fname, '/');
+        return QString("%1+0x%2").arg(QString::fromLocal8Bit(lib ? lib + 1 : info.dli_fname))
+                .arg(reinterpret_cast<quintptr>(addr) - reinterpret_cast<quintptr>(info.dli_fbase), 0, 16);
+    }
+#endif
+    return QString("0x%1").arg(reinterpret_cast<quintptr>(addr), 0, 16);
+}
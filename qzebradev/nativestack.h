@@ -0,0 +1,39 @@
+#ifndef QZebraDev_NATIVESTACK_H
+#define QZebraDev_NATIVESTACK_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QStringList>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Native stack of other thread, for the long function detector
+ *
+ * The thread is interrupted by a real-time signal (tgkill by kernel thread id, so a finished thread
+ * is an error, not a crash as pthread_kill with a freed pthread_t), the handler saves
+ * return addresses by backtrace (the first call is made by install, it loads libgcc; it is not strictly
+ * async-signal-safe, see CpuSampler, but the capture is rare, only for stalled threads)
+ * and wakes the caller by a semaphore. Symbolization (dladdr, demangle) is done by the caller thread.
+ * Only one capture at a time, captures are serialized. Linux (glibc) only, else empty.
+ */
+class NativeStack
+{
+public:
+
+    static bool install(int signo = 0); //! NOTE 0 - SIGRTMIN + 5
+    static bool isInstalled();
+
+    static int currentThreadId();   //! NOTE Kernel thread id (gettid), 0 if not supported
+    static QVector<void *> capture(int tid, int timeoutMs = 100); //! NOTE Waits at most 2 * timeoutMs, empty if the handler is blocked
+    static QStringList symbolize(const QVector<void *> &frames);
+    static QString symbolName(void *addr); //! NOTE Function name, or library+offset, or address
+
+private:
+    static void handler(int signo);
+};
+
+}
+
+#endif // QZebraDev_NATIVESTACK_H
@@ -0,0 +1,236 @@
+#include "perfcounters.h"
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <time.h>
+#define QZebraDev_PERFCOUNTERS_SUPPORTED
+#if defined(Q_PROCESSOR_X86)
+#define QZebraDev_PERFCOUNTERS_RDPMC
+#endif
+#endif
+
+using namespace QZebraDev;
+
+#if defined(QZebraDev_PERFCOUNTERS_SUPPORTED)
+static int perfEventOpen(quint32 type, quint64 config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+
+    //! NOTE Software events are kernel events (context switches), hardware counts only user space
+    if (type == PERF_TYPE_HARDWARE) {
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+    }
+
+    //! NOTE The current thread, any cpu
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+#endif
+
+#if defined(QZebraDev_PERFCOUNTERS_RDPMC)
+static inline quint64 rdpmc(quint32 counter)
+{
+    quint32 low, high;
+    asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+    return static_cast<quint64>(low) | (static_cast<quint64>(high) << 32);
+}
+
+//! NOTE As in linux/perf_event.h, the page is updated by the kernel on reschedule, lock is a sequence
+static inline bool readRdpmc(const volatile perf_event_mmap_page *pc, quint64 &value)
+{
+    quint32 seq;
+    qint64 count;
+    do {
+        seq = pc->lock;
+        asm volatile("" ::: "memory");
+
+        quint32 index = pc->index;
+        if (!pc->cap_user_rdpmc || index == 0) {
+            return false; //! NOTE Not scheduled on the PMU now
+        }
+
+        count = pc->offset;
+        int shift = 64 - pc->pmc_width;
+        qint64 pmc = static_cast<qint64>(rdpmc(index - 1) << shift) >> shift;
+        count += pmc;
+
+        asm volatile("" ::: "memory");
+    } while (pc->lock != seq);
+
+    value = static_cast<quint64>(count);
+    return true;
+}
+#endif
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < COUNTERS_COUNT; ++i) {
+        m_fds[i] = -1;
+        m_pages[i] = 0;
+        m_fallback[i] = false;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+bool PerfCounters::open()
+{
+    close();
+
+#if defined(QZebraDev_PERFCOUNTERS_SUPPORTED)
+    struct Event {
+        quint32 type;
+        quint64 config;
+    };
+
+    static const Event events[COUNTERS_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK }
+    };
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < COUNTERS_COUNT; ++i) {
+        m_fds[i] = perfEventOpen(events[i].type, events[i].config);
+        if (m_fds[i] == -1) {
+            //! NOTE Hardware is not available without PMU access, software is read without perf events
+            m_fallback[i] = events[i].type == PERF_TYPE_SOFTWARE;
+            continue;
+        }
+
+#if defined(QZebraDev_PERFCOUNTERS_RDPMC)
+        if (events[i].type == PERF_TYPE_HARDWARE) {
+            void *page = mmap(0, pageSize, PROT_READ, MAP_SHARED, m_fds[i], 0);
+            if (page != MAP_FAILED) {
+                if (static_cast<perf_event_mmap_page *>(page)->cap_user_rdpmc) {
+                    m_pages[i] = page;
+                } else {
+                    munmap(page, pageSize);
+                }
+            }
+        }
+#else
+        Q_UNUSED(pageSize);
+#endif
+    }
+
+    for (int i = 0; i < COUNTERS_COUNT; ++i) {
+        if (isAvailable(static_cast<Counter>(i))) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+void PerfCounters::close()
+{
+#if defined(QZebraDev_PERFCOUNTERS_SUPPORTED)
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < COUNTERS_COUNT; ++i) {
+        if (m_pages[i]) {
+            munmap(m_pages[i], pageSize);
+            m_pages[i] = 0;
+        }
+
+        if (m_fds[i] != -1) {
+            ::close(m_fds[i]);
+            m_fds[i] = -1;
+        }
+
+        m_fallback[i] = false;
+    }
+#endif
+}
+
+bool PerfCounters::isAvailable(Counter c) const
+{
+    return m_fds[c] != -1 || m_fallback[c];
+}
+
+bool PerfCounters::isHardware() const
+{
+    return isAvailable(Cycles) && isAvailable(Instructions);
+}
+
+bool PerfCounters::isRdpmc(Counter c) const
+{
+    return m_pages[c] != 0;
+}
+
+quint64 PerfCounters::readCounter(int c) const
+{
+#if defined(QZebraDev_PERFCOUNTERS_SUPPORTED)
+    if (m_fallback[c]) {
+        if (c == CpuTimeNs) {
+            struct timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return static_cast<quint64>(ts.tv_sec) * Q_UINT64_C(1000000000) + ts.tv_nsec;
+        }
+
+        if (c == ContextSwitches) {
+            struct rusage usage;
+            if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+                return static_cast<quint64>(usage.ru_nvcsw + usage.ru_nivcsw);
+            }
+        }
+
+        return 0;
+    }
+
+    if (m_fds[c] == -1) {
+        return 0;
+    }
+
+#if defined(QZebraDev_PERFCOUNTERS_RDPMC)
+    quint64 value = 0;
+    if (m_pages[c] && readRdpmc(static_cast<const volatile perf_event_mmap_page *>(m_pages[c]), value)) {
+        return value;
+    }
+#endif
+
+    quint64 count = 0;
+    if (::read(m_fds[c], &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    return count;
+#else
+    Q_UNUSED(c);
+    return 0;
+#endif
+}
+
+void PerfCounters::read(Values &values) const
+{
+    for (int i = 0; i < COUNTERS_COUNT; ++i) {
+        values.v[i] = readCounter(i);
+    }
+}
+
+const char* PerfCounters::counterName(Counter c)
+{
+    static const char* names[COUNTERS_COUNT] = {
+        "cycles",
+        "instructions",
+        "cache-misses",
+        "branch-misses",
+        "context-switches",
+        "cpu-time-ns"
+    };
+    return (c >= 0 && c < COUNTERS_COUNT) ? names[c] : "";
+}
@@ -0,0 +1,65 @@
+#ifndef QZebraDev_PERFCOUNTERS_H
+#define QZebraDev_PERFCOUNTERS_H
+
+#include <QtGlobal>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Counters of the current thread, used by Profiler (Options::funcsPerfCountersEnabled)
+ *
+ * Hardware counters are opened by perf_event_open (user space only), each one separately,
+ * so a missing one does not disable others. They are read by rdpmc (x86) from the mapped page
+ * of the counter if the kernel allows it, else by read (syscall).
+ * If perf events are blocked (perf_event_paranoid, containers, VMs), hardware counters are not available
+ * and software counters are read by clock_gettime (thread CPU time) and getrusage (context switches).
+ * Opened and read only by the owner thread. Linux only, else nothing is available.
+ *
+ * Cost of read: rdpmc is tens of cycles, any other counter is a syscall (read of perf event,
+ * clock_gettime of thread CPU clock, getrusage), about 0.2-1 us each, up to COUNTERS_COUNT per read.
+ * Profiler reads on begin and end of sampled calls, so for hot functions use Options::funcsSampleRate.
+ */
+class PerfCounters
+{
+public:
+    enum Counter {
+        Cycles = 0,
+        Instructions,
+        CacheMisses,
+        BranchMisses,
+        ContextSwitches,
+        CpuTimeNs,
+        COUNTERS_COUNT
+    };
+
+    struct Values {
+        quint64 v[COUNTERS_COUNT];
+        Values() { for (int i = 0; i < COUNTERS_COUNT; ++i) { v[i] = 0; } }
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    bool open();    //! NOTE For the current thread, false if nothing is available
+    void close();
+
+    bool isAvailable(Counter c) const;
+    bool isHardware() const;    //! NOTE Cycles and instructions are available
+    bool isRdpmc(Counter c) const;
+
+    void read(Values &values) const; //! NOTE Not available are 0
+
+    static const char* counterName(Counter c);
+
+private:
+    quint64 readCounter(int c) const;
+
+    int m_fds[COUNTERS_COUNT];
+    void *m_pages[COUNTERS_COUNT];   //! NOTE perf_event_mmap_page, for rdpmc
+    bool m_fallback[COUNTERS_COUNT]; //! NOTE Software, without perf events
+};
+
+}
+
+#endif // QZebraDev_PERFCOUNTERS_H
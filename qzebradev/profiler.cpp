@@ -1,19 +1,94 @@
 #include "profiler.h"
+#include "nativestack.h"
+#include "cpusampler.h"
 #include <QDebug>
 #include <QCoreApplication>
+#include <QSet>
 #include <QPair>
+#include <QFile>
+#include <QWaitCondition>
+#include <QtAlgorithms>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(Q_OS_UNIX)
+#include <time.h>
+#endif
 
 using namespace QZebraDev;
 
+static inline qint64 nowNs()
+{
+#if defined(Q_OS_UNIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+#else
+    static QElapsedTimer timer;
+    if (!timer.isValid()) {
+        timer.start();
+    }
+    return timer.nsecsElapsed() + 1; //! NOTE Not 0, 0 is not started
+#endif
+}
+
+class Profiler::WindowThread : public QThread
+{
+public:
+    WindowThread(Profiler *profiler, int intervalMs)
+        : m_profiler(profiler), m_intervalMs(intervalMs), m_stop(false) {}
+
+    void stop()
+    {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wait.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            m_profiler->takeWindowSnapshot(); //! NOTE The first is the begin of the first window
+
+            QMutexLocker locker(&m_mutex);
+            if (!m_stop) {
+                m_wait.wait(&m_mutex, m_intervalMs);
+            }
+            if (m_stop) {
+                return;
+            }
+        }
+    }
+
+private:
+    Profiler *m_profiler;
+    unsigned long m_intervalMs;
+    bool m_stop;
+    QMutex m_mutex;
+    QWaitCondition m_wait;
+};
+
+//! NOTE Allocations of beginFunc, endFunc (stat chunks, nodes, histograms, trace) are not counted
+struct InProfiler {
+    bool &flag;
+    explicit InProfiler(bool &f) : flag(f) { flag = true; }
+    ~InProfiler() { flag = false; }
+};
+
 Profiler* Profiler::s_profiler(0);
 Profiler::Options Profiler::m_options;
+thread_local Profiler::ThreadData* Profiler::s_threadData(0);
+thread_local Profiler::ThreadGuard Profiler::s_threadGuard;
+thread_local bool Profiler::s_threadFinished(false);
+thread_local int Profiler::s_threadRejected(0);
 
-struct Sleep : public QThread { using QThread::msleep; };
-
-#define MAIN_THREAD_INDEX 0
 
 Profiler::Profiler()
-    : QObject(), m_printer(0)
+    : QObject(), m_printer(0), m_sampler(0), m_windowThread(0)
 {
     connect(this, SIGNAL(detectorStarted(int)), &m_detector.timer, SLOT(start(int)), Qt::QueuedConnection);
     connect(this, SIGNAL(detectorStoped()), &m_detector.timer, SLOT(stop()), Qt::QueuedConnection);
@@ -27,28 +102,28 @@ Profiler::Profiler()
 Profiler::~Profiler()
 {
     s_profiler = 0;
+
+    if (m_windowThread) {
+        m_windowThread->stop();
+        delete m_windowThread;
+        m_windowThread = 0;
+    }
+
     delete m_printer;
+    delete m_sampler;
 
     if (m_detector.enabled) {
         emit detectorStoped();
         m_detector.thread.exit();
     }
 
-    {
-        QMutexLocker locker(&m_funcs.mutex);
-        for (int i = 0; i < m_funcs.threads.count(); ++i) {
-            if (i == MAIN_THREAD_INDEX && m_detector.enabled) {
-                m_detector.mutex.lock();
-            }
-
-            FuncTimers timers = m_funcs.timers[i];
-            qDeleteAll(timers);
-            m_funcs.timers[i].clear();
+    delete m_detector.thresholds.load();
+    qDeleteAll(m_detector.retired);
 
-            if (i == MAIN_THREAD_INDEX && m_detector.enabled) {
-                m_detector.mutex.unlock();
-            }
-        }
+    {
+        QWriteLocker locker(&m_funcs.lock);
+        qDeleteAll(m_funcs.threads);
+        m_funcs.threads.clear();
     }
     
     {
@@ -62,18 +137,64 @@ void Profiler::setup(const Options &opt, Printer *printer)
 {
     m_options = opt;
     m_options.funcsMaxThreadCount = m_options.funcsMaxThreadCount < 1 ? 1 : m_options.funcsMaxThreadCount;
+    m_funcs.limitGeneration.ref(); //! NOTE The limit can be changed
+
+    //! Long func thresholds
+    LongFuncThresholds *thresholds = new LongFuncThresholds();
+    thresholds->threadDefault = opt.longFuncThreshold;
+    thresholds->byThread = opt.longFuncThreadThresholds;
+    int minThreshold = opt.longFuncThreshold;
+    QHash<QString, int>::ConstIterator it = opt.longFuncFuncThresholds.constBegin();
+    for (; it != opt.longFuncFuncThresholds.constEnd(); ++it) {
+        int id = funcId(it.key()); //! NOTE The same id, as TRACEFUNC of this function
+        if (id != -1) {
+            thresholds->byFunc.insert(id, it.value());
+            minThreshold = qMin(minThreshold, it.value());
+        }
+    }
+
+    foreach (int threshold, opt.longFuncThreadThresholds) {
+        minThreshold = qMin(minThreshold, threshold);
+    }
 
-    //! Func timers
-    m_funcs.timers.fill(FuncTimers(), m_options.funcsMaxThreadCount);
-    m_funcs.threads.fill(0, m_options.funcsMaxThreadCount);
-    m_funcs.threads[MAIN_THREAD_INDEX] = reinterpret_cast<quintptr>(qApp->thread());
+    m_detector.minThreshold = minThreshold;
+    publishThresholds(thresholds);
+
+    {
+        //! NOTE After publish, new threads resolve by the new thresholds
+        QWriteLocker locker(&m_funcs.lock);
+        foreach (ThreadData *td, m_funcs.threads) {
+            td->longFuncThreshold = thresholds->byThread.value(td->name, thresholds->threadDefault);
+        }
+    }
+
+    if (m_options.longFuncNativeStack) {
+        NativeStack::install();
+    }
+
+    //! Rolling windows
+    if (m_windowThread) {
+        m_windowThread->stop();
+        delete m_windowThread;
+        m_windowThread = 0;
+    }
+
+    {
+        QMutexLocker locker(&m_windows.mutex);
+        m_windows.snapshots.clear();
+    }
+
+    if (m_options.windowIntervalMs > 0) {
+        m_windowThread = new WindowThread(this, m_options.windowIntervalMs);
+        m_windowThread->start();
+    }
 
     //! Long func detector
     if (m_options.longFuncDetectorEnabled) {
 
         m_detector.enabled = true;
         m_detector.thread.start();
-        emit detectorStarted(m_options.longFuncThreshold * 0.45);
+        emit detectorStarted(m_detector.minThreshold * 0.45);
 
     } else {
 
@@ -105,286 +226,1159 @@ void Profiler::stepTime(const QString &tag, const QString &info, bool isRestart)
     printer()->printStep(tag, stepTimer->beginMs(), stepTimer->stepMs(), info);
     
     stepTimer->nextStep();
+
+    if (m_options.traceCaptureEnabled) {
+        ThreadData *td = threadData();
+        if (td) {
+            resetIfCleared(td);
+
+            int capacity = m_options.traceBufferSize < 2 ? 2 : m_options.traceBufferSize;
+            if (m_steps.traceTexts.count() != capacity) {
+                m_steps.traceTexts = QVector<TraceStepText>(capacity);
+                m_steps.traceTextsPos = 0;
+            }
+
+            qint64 ns = nowNs();
+            int id = m_steps.traceTextsPos;
+            m_steps.traceTexts[id].ns = ns;
+            m_steps.traceTexts[id].text = tag + ": " + info;
+            m_steps.traceTextsPos = (id + 1) % capacity;
+            addTraceEvent(td, ns, id, TraceStep);
+        }
+    }
 }
 
-void Profiler::beginFunc(const QString &func, quintptr th)
+Profiler::ThreadData* Profiler::threadData()
 {
-    int index = m_funcs.threadIndex(th);
-    if (index == -1) {
-        index = m_funcs.addThread(th);
+    ThreadData *td = s_threadData;
+    if (td) {
+        return td;
+    }
+
+    if (s_threadFinished) { //! NOTE Calls from destructors of other thread locals
+        return 0;
+    }
+
+    //! NOTE Without the lock, else every call of the rejected thread locks and scans the list
+    int limitGeneration = m_funcs.limitGeneration.loadAcquire();
+    if (s_threadRejected == limitGeneration) {
+        return 0;
+    }
+
+    QWriteLocker locker(&m_funcs.lock);
+    if (m_funcs.threads.count() >= m_options.funcsMaxThreadCount) {
+        //! NOTE The oldest finished thread is dropped, readers do not use it (write lock)
+        int index = -1;
+        for (int i = 0; i < m_funcs.threads.count(); ++i) {
+            if (m_funcs.threads.at(i)->alive.loadAcquire() == 0) {
+                index = i;
+                break;
+            }
+        }
+
         if (index == -1) {
-            return;
+            s_threadRejected = limitGeneration;
+            return 0;
+        }
+
+        delete m_funcs.threads.takeAt(index);
+    }
+
+    QThread *thread = QThread::currentThread();
+    td = new ThreadData();
+    td->thread = reinterpret_cast<quintptr>(thread);
+    td->tid = NativeStack::currentThreadId();
+    td->name = thread->objectName().isEmpty() ? QString("0x%1").arg(td->thread, 0, 16) : thread->objectName();
+    td->isMain = qApp && qApp->thread() == thread;
+    const LongFuncThresholds *thresholds = m_detector.thresholds.loadAcquire();
+    td->longFuncThreshold = thresholds ? thresholds->byThread.value(td->name, thresholds->threadDefault) : 0;
+    td->generation = m_funcs.generation.load();
+    m_funcs.threads.append(td);
+
+    s_threadData = td;
+    s_threadGuard.registered = true; //! NOTE Constructs the guard of the thread, so its destructor is called on exit
+    return td;
+}
+
+void Profiler::threadFinished(ThreadData *td)
+{
+    //! NOTE The owner is finished, fds and mapped pages of its counters are not needed
+    if (td->perf) {
+        td->perf->close();
+    }
+
+    td->alive.storeRelease(0); //! NOTE The last, then the data can be deleted by registration of new thread
+}
+
+Profiler::ThreadGuard::~ThreadGuard()
+{
+    ThreadData *td = s_threadData;
+    s_threadData = 0;
+    s_threadFinished = true;
+
+    //! NOTE Data is deleted with the profiler
+    if (td && registered && s_profiler) {
+        threadFinished(td);
+    }
+}
+
+void Profiler::resetIfCleared(ThreadData *td) const
+{
+    int generation = m_funcs.generation.load();
+    if (td->generation == generation) {
+        return;
+    }
+
+    //! NOTE Stats are not deleted, readers can use them, only counters are reset
+    for (int c = 0; c < FUNCS_MAX_CHUNKS; ++c) {
+        FuncStat *chunk = td->stats[c].load();
+        if (!chunk) {
+            continue;
+        }
+
+        for (int i = 0; i < FUNCS_CHUNK_SIZE; ++i) {
+            chunk[i].callcount = 0;
+            chunk[i].sampledcount = 0;
+            chunk[i].sumtimeNs = 0;
+            chunk[i].selftimeNs = 0;
+            chunk[i].allocCount = 0;
+            chunk[i].allocBytes = 0;
+            chunk[i].perf = PerfCounters::Values();
+            if (Histogram *h = chunk[i].histogram.load()) {
+                h->reset();
+            }
+        }
+    }
+
+    int nodesCount = td->nodesCount.load();
+    for (int i = 0; i < nodesCount; ++i) {
+        Node *n = td->node(i);
+        n->callcount = 0;
+        n->sampledcount = 0;
+        n->sumtimeNs = 0;
+        n->selftimeNs = 0;
+    }
+
+    td->traceCount.store(0);
+
+    td->generation = generation;
+}
+
+PerfCounters* Profiler::perfCounters(ThreadData *td) const
+{
+    //! NOTE Counters are of the calling thread, so opened by the owner, once
+    if (!td->perfOpened) {
+        td->perfOpened = true;
+
+        PerfCounters *perf = new PerfCounters();
+        if (perf->open()) {
+            td->perfBegin = new PerfCounters::Values[STACK_MAX_DEPTH];
+            td->perf = perf;
+        } else {
+            delete perf;
+        }
+    }
+    return td->perf;
+}
+
+void Profiler::addTraceEvent(ThreadData *td, qint64 ns, int id, TraceEventType type) const
+{
+    TraceEvent *trace = td->trace.load();
+    if (!trace) {
+        td->traceCapacity = m_options.traceBufferSize < 2 ? 2 : m_options.traceBufferSize;
+        trace = new TraceEvent[td->traceCapacity];
+        td->trace.storeRelease(trace);
+    }
+
+    qint64 count = td->traceCount.load();
+    TraceEvent &e = trace[count % td->traceCapacity];
+    e.ns = ns;
+    e.id = id;
+    e.type = type;
+    td->traceCount.storeRelease(count + 1);
+}
+
+Profiler::ThreadData::~ThreadData()
+{
+    for (int c = 0; c < FUNCS_MAX_CHUNKS; ++c) {
+        FuncStat *chunk = stats[c].load();
+        if (!chunk) {
+            continue;
+        }
+
+        for (int i = 0; i < FUNCS_CHUNK_SIZE; ++i) {
+            delete chunk[i].histogram.load();
+        }
+        delete [] chunk;
+    }
+
+    for (int c = 0; c < NODES_MAX_CHUNKS; ++c) {
+        delete [] nodes[c].load();
+    }
+
+    delete [] trace.load();
+    delete perf;
+    delete [] perfBegin;
+}
+
+int Profiler::ThreadData::addNode(int parent, int funcId)
+{
+    int index = nodesCount.load();
+    if (index >= NODES_CHUNK_SIZE * NODES_MAX_CHUNKS) {
+        return -1;
+    }
+
+    Node *chunk = nodes[index / NODES_CHUNK_SIZE].load();
+    if (!chunk) {
+        chunk = new Node[NODES_CHUNK_SIZE];
+        nodes[index / NODES_CHUNK_SIZE].storeRelease(chunk);
+    }
+
+    Node &n = chunk[index % NODES_CHUNK_SIZE];
+    n = Node();
+    n.funcId = funcId;
+    n.parent = parent;
+
+    nodesCount.storeRelease(index + 1);
+    return index;
+}
+
+int Profiler::ThreadData::childNode(int parent, int funcId)
+{
+    Node *p = node(parent);
+    for (int i = p->firstChild; i != -1; i = node(i)->nextSibling) {
+        if (node(i)->funcId == funcId) {
+            return i;
+        }
+    }
+
+    int index = addNode(parent, funcId);
+    if (index != -1) {
+        node(index)->nextSibling = p->firstChild;
+        p->firstChild = index;
+    }
+    return index;
+}
+
+// Histogram
+
+void Profiler::Histogram::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    count = 0;
+    maxNs = 0;
+}
+
+int Profiler::Histogram::bucketIndex(qint64 ns)
+{
+    if (ns < SUB_COUNT) {
+        return ns < 0 ? 0 : static_cast<int>(ns);
+    }
+
+    //! NOTE Position of the highest bit gives the power of two, next SUB_BITS bits give the sub-bucket
+    int msb = 63 - qCountLeadingZeroBits(static_cast<quint64>(ns));
+    int shift = msb - SUB_BITS;
+    if (shift > MAX_SHIFT) {
+        return BUCKETS_COUNT - 1;
+    }
+
+    int sub = static_cast<int>(ns >> shift) - SUB_COUNT;
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+qint64 Profiler::Histogram::bucketUpperNs(int index)
+{
+    if (index < SUB_COUNT) {
+        return index;
+    }
+
+    int shift = index / SUB_COUNT - 1;
+    qint64 sub = index % SUB_COUNT;
+    return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void Profiler::Histogram::record(qint64 ns)
+{
+    ++counts[bucketIndex(ns)];
+    ++count;
+    if (ns > maxNs) {
+        maxNs = ns;
+    }
+}
+
+void Profiler::Histogram::merge(const Histogram &other)
+{
+    for (int i = 0; i < BUCKETS_COUNT; ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    maxNs = qMax(maxNs, other.maxNs);
+}
+
+qint64 Profiler::Histogram::percentileNs(double p) const
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    quint64 target = static_cast<quint64>(p / 100.0 * count + 0.5);
+    target = qBound(Q_UINT64_C(1), target, count);
+
+    quint64 sum = 0;
+    for (int i = 0; i < BUCKETS_COUNT; ++i) {
+        sum += counts[i];
+        if (sum >= target) {
+            return qMin(bucketUpperNs(i), maxNs);
+        }
+    }
+    return maxNs;
+}
+
+// Function ids
+
+//! NOTE Lookups are under read lock, so TRACEFUNC_INFO of many threads are not serialized
+struct FuncRegistrar {
+    QReadWriteLock lock;
+    QHash<QString, int> ids;
+    QVector<QString> names;
+    QAtomicInt count;
+};
+
+static FuncRegistrar* funcRegistrar()
+{
+    static FuncRegistrar registrar; //! NOTE Function static, it is used by static init of TRACEFUNC
+    return &registrar;
+}
+
+static int registerName(FuncRegistrar *r, const QString &name, int maxCount)
+{
+    {
+        QReadLocker locker(&r->lock);
+        QHash<QString, int>::ConstIterator it = r->ids.constFind(name);
+        if (it != r->ids.constEnd()) {
+            return it.value();
+        }
+    }
+
+    QWriteLocker locker(&r->lock);
+    QHash<QString, int>::ConstIterator it = r->ids.constFind(name); //! NOTE Can be registered by other thread
+    if (it != r->ids.constEnd()) {
+        return it.value();
+    }
+
+    if (r->names.count() >= maxCount) {
+        return -1;
+    }
+
+    int id = r->names.count();
+    r->names.append(name);
+    r->ids.insert(name, id);
+    r->count.storeRelease(r->names.count());
+    return id;
+}
+
+int Profiler::funcId(const QString &func)
+{
+    return registerName(funcRegistrar(), func, FUNCS_CHUNK_SIZE * FUNCS_MAX_CHUNKS);
+}
+
+QString Profiler::funcName(int funcId)
+{
+    FuncRegistrar *r = funcRegistrar();
+    QReadLocker locker(&r->lock);
+    return r->names.value(funcId);
+}
+
+QVector<QString> Profiler::funcNames()
+{
+    FuncRegistrar *r = funcRegistrar();
+    QReadLocker locker(&r->lock);
+    return r->names;
+}
+
+int Profiler::funcsCount()
+{
+    return funcRegistrar()->count.loadAcquire();
+}
+
+static inline double sampleScale(uint callcount, uint sampledcount)
+{
+    return sampledcount > 0 ? static_cast<double>(callcount) / sampledcount : 0;
+}
+
+void Profiler::beginFunc(int funcId)
+{
+    if (funcId < 0) {
+        return;
+    }
+
+    ThreadData *td = threadData();
+    if (!td) {
+        return;
+    }
+
+    InProfiler inProfiler(td->inProfiler);
+    resetIfCleared(td);
+
+    if (td->depth == STACK_MAX_DEPTH) {
+        ++td->overflow;
+        return;
+    }
+
+    //! NOTE Counter per function per thread, cheaper than random, calls of a site are regular enough
+    FuncStat *stat = td->stat(funcId);
+    bool sampled = m_options.funcsSampleRate <= 1 || (stat->sampleCounter++ % m_options.funcsSampleRate) == 0;
+    //! NOTE Not sampled calls are timed too while the detector is enabled, else it misses them
+    qint64 now = (sampled || m_detector.enabled) ? nowNs() : 0;
+
+    int node = -1;
+    if (m_options.funcsCallTreeEnabled) {
+        int parent = 0;
+        if (td->depth > 0) {
+            parent = td->stack[td->depth - 1].node;
+        } else if (td->nodesCount.load() == 0) {
+            parent = td->addNode(-1, -1); //! NOTE Root
+        }
+
+        if (parent != -1) {
+            node = td->childNode(parent, funcId);
+        }
+    }
+
+    bool perf = sampled && m_options.funcsPerfCountersEnabled && perfCounters(td);
+
+    td->beginStackWrite();
+    Frame &frame = td->stack[td->depth];
+    frame.funcId = funcId;
+    frame.node = node;
+    frame.sampled = sampled;
+    frame.perf = perf;
+    frame.beginNs = now;
+    frame.childNs = 0;
+    ++td->depth;
+    td->endStackWrite();
+
+    if (!sampled) {
+        return;
+    }
+
+    if (stat->activeCount++ == 0) {
+        stat->beginNs = now;
+    }
+
+    if (m_options.traceCaptureEnabled) {
+        addTraceEvent(td, now, funcId, TraceBegin);
+    }
+
+    //! NOTE The last, to count less of the profiler
+    if (perf) {
+        td->perf->read(td->perfBegin[td->depth - 1]);
+    }
+}
+
+void Profiler::endFunc(int funcId)
+{
+    ThreadData *td = s_threadData;
+    if (!td || funcId < 0) {
+        return;
+    }
+
+    InProfiler inProfiler(td->inProfiler);
+    resetIfCleared(td);
+
+    if (td->overflow > 0) {
+        --td->overflow;
+        return;
+    }
+
+    //! NOTE Markers are scoped, so the top of stack is this function, else it was enabled during the call
+    if (td->depth == 0 || td->stack[td->depth - 1].funcId != funcId) {
+        return;
+    }
+
+    //! NOTE The first, to count less of the profiler
+    PerfCounters::Values perfEnd;
+    if (td->stack[td->depth - 1].perf) {
+        td->perf->read(perfEnd);
+    }
+
+    td->beginStackWrite();
+    --td->depth;
+    td->endStackWrite();
+
+    const Frame &frame = td->stack[td->depth];
+    FuncStat *stat = td->stat(funcId);
+    stat->callcount++;
+
+    if (!frame.sampled) {
+        if (frame.node != -1) {
+            td->node(frame.node)->callcount++;
+        }
+
+        //! NOTE Estimated by sampled calls, to not count it in the self time of the caller
+        if (td->depth > 0 && stat->sampledcount > 0) {
+            td->stack[td->depth - 1].childNs += stat->sumtimeNs / stat->sampledcount;
+        }
+
+        return;
+    }
+
+    qint64 now = nowNs();
+    qint64 calltimeNs = now - frame.beginNs;
+    if (td->depth > 0) {
+        td->stack[td->depth - 1].childNs += calltimeNs;
+    }
+
+    if (frame.node != -1) {
+        Node *node = td->node(frame.node);
+        node->callcount++;
+        node->sampledcount++;
+        node->sumtimeNs += calltimeNs;
+        node->selftimeNs += calltimeNs - frame.childNs;
+    }
+
+    stat->sampledcount++;
+    stat->selftimeNs += calltimeNs - frame.childNs;
+    if (--stat->activeCount == 0) { //! NOTE Recursive calls are inside the outermost
+        stat->sumtimeNs += calltimeNs;
+        stat->beginNs = 0;
+
+        if (frame.perf) {
+            const PerfCounters::Values &perfBegin = td->perfBegin[td->depth];
+            for (int i = 0; i < PerfCounters::COUNTERS_COUNT; ++i) {
+                stat->perf.v[i] += perfEnd.v[i] - perfBegin.v[i];
+            }
+        }
+    }
+
+    if (m_options.funcsHistogramEnabled) {
+        Histogram *h = stat->histogram.load();
+        if (!h) {
+            h = new Histogram();
+            stat->histogram.storeRelease(h);
+        }
+        h->record(calltimeNs);
+    }
+
+    if (m_options.traceCaptureEnabled) {
+        addTraceEvent(td, now, funcId, TraceEnd);
+    }
+
+    double calltimeMs = calltimeNs * 0.000001; //! NOTE To millisecond
+
+    if (m_options.funcsTraceEnabled) {
+        printer()->printTrace(funcName(funcId), calltimeMs, stat->callcount, stat->sumtimeNs * 0.000001 * sampleScale(stat->callcount, stat->sampledcount));
+    }
+
+    if (m_detector.enabled && calltimeMs > m_detector.minThreshold && (td->isMain || m_options.longFuncDetectorAllThreads)
+            && calltimeMs > longFuncThreshold(td, funcId)) {
+        printer()->printEndLongFunc(funcName(funcId), calltimeMs);
+    }
+}
+
+void Profiler::countAlloc(size_t size)
+{
+    //! NOTE Called inside malloc, so no allocations and locks here, only the own data of the thread
+    ThreadData *td = s_threadData;
+    if (!td || td->depth == 0 || td->inProfiler || !m_options.funcsAllocEnabled) {
+        return;
+    }
+
+    //! NOTE Stat exists, it is created by beginFunc
+    FuncStat *stat = const_cast<FuncStat *>(td->statIfExists(td->stack[td->depth - 1].funcId));
+    if (stat) {
+        stat->allocCount++;
+        stat->allocBytes += size;
+    }
+}
+
+double Profiler::StepTimer::beginMs() const
+{
+    return this->beginTime.nsecsElapsed() * 0.000001; //! NOTE To millisecond
+}
+
+double Profiler::StepTimer::stepMs() const
+{
+    return this->stepTime.nsecsElapsed() * 0.000001; //! NOTE To millisecond
+}
+
+void Profiler::StepTimer::start()
+{
+    this->beginTime.start();
+    this->stepTime.start();
+}
+void Profiler::StepTimer::restart()
+{
+    this->beginTime.restart();
+    this->stepTime.restart();
+}
+
+void Profiler::StepTimer::nextStep()
+{
+    this-> stepTime.restart();
+}
+
+void Profiler::clear()
+{
+    //! NOTE Threads reset own data on next call, data of other generation is not read
+    m_funcs.generation.ref();
+    m_funcs.limitGeneration.ref();
+
+    {
+        QMutexLocker wlocker(&m_windows.mutex);
+        m_windows.snapshots.clear();
+    }
+
+    QMutexLocker slocker(&m_steps.mutex);
+    qDeleteAll(m_steps.timers);
+    m_steps.timers.clear();
+}
+
+Profiler::Data Profiler::threadsData(Data::Mode mode) const
+{
+    return collectData(mode, true);
+}
+
+Profiler::Data Profiler::collectData(Data::Mode mode, bool withDetails) const
+{
+    Data data;
+    data.mainThread = reinterpret_cast<quintptr>(qApp ? qApp->thread() : 0);
+
+    int generation = m_funcs.generation.load();
+    const QVector<QString> names = funcNames();
+    QHash<quintptr, QHash<QString, Histogram> > histograms; //! NOTE Merged, if address of thread is reused
+    QReadLocker locker(&m_funcs.lock);
+    foreach (ThreadData *td, m_funcs.threads) {
+
+        if (td->generation != generation) { //! NOTE Not used after clear
+            continue;
+        }
+
+        if (td->isMain) {
+            if (mode == Data::OnlyOther) {
+                continue;
+            }
+        } else {
+            if (mode == Data::OnlyMain) {
+                continue;
+            }
+        }
+
+        //! NOTE Address of finished thread can be reused by new thread, so merge
+        Data::Thread &thdata = data.threads[td->thread];
+        thdata.thread = td->thread;
+
+        int count = names.count(); //! NOTE Not funcsCount, ids registered after the copy of names are skipped
+        for (int id = 0; id < count; ++id) {
+            const FuncStat *stat = td->statIfExists(id);
+            if (!stat || stat->callcount == 0) {
+                continue;
+            }
+
+            const QString &name = names.at(id);
+            Data::Func &f = thdata.funcs[name];
+            double scale = sampleScale(stat->callcount, stat->sampledcount);
+            f.func = name;
+            f.callcount += stat->callcount;
+            f.sumtimeMs += stat->sumtimeNs * 0.000001 * scale;
+            f.selftimeMs += stat->selftimeNs * 0.000001 * scale;
+            f.allocCount += stat->allocCount; //! NOTE Not sampled, every allocation is counted
+            f.allocBytes += stat->allocBytes;
+            f.cycles += stat->perf.v[PerfCounters::Cycles] * scale;
+            f.instructions += stat->perf.v[PerfCounters::Instructions] * scale;
+            f.cacheMisses += stat->perf.v[PerfCounters::CacheMisses] * scale;
+            f.branchMisses += stat->perf.v[PerfCounters::BranchMisses] * scale;
+            f.contextSwitches += stat->perf.v[PerfCounters::ContextSwitches] * scale;
+            f.cpuTimeMs += stat->perf.v[PerfCounters::CpuTimeNs] * 0.000001 * scale;
+
+            const Histogram *h = withDetails ? stat->histogram.loadAcquire() : 0;
+            if (h) {
+                histograms[td->thread][name].merge(*h);
+            }
+        }
+
+        //! NOTE Children are restored by parent, links are changed by the owner thread
+        int nodesCount = withDetails ? td->nodesCount.loadAcquire() : 0;
+        if (nodesCount > 0 && thdata.nodes.isEmpty()) {
+            thdata.nodes.resize(nodesCount);
+            for (int i = 0; i < nodesCount; ++i) {
+                const Node *n = td->node(i);
+                Data::Node &dn = thdata.nodes[i];
+                dn.func = n->funcId == -1 ? QString() : names.value(n->funcId);
+                dn.parent = n->parent;
+                double scale = sampleScale(n->callcount, n->sampledcount);
+                dn.callcount = n->callcount;
+                dn.sumtimeMs = n->sumtimeNs * 0.000001 * scale;
+                dn.selftimeMs = n->selftimeNs * 0.000001 * scale;
+                if (n->parent != -1) {
+                    thdata.nodes[n->parent].children.append(i);
+                }
+            }
+        }
+    }
+
+    QHash<quintptr, QHash<QString, Histogram> >::ConstIterator tit = histograms.constBegin(), tend = histograms.constEnd();
+    for (; tit != tend; ++tit) {
+        Data::Thread &thdata = data.threads[tit.key()];
+        QHash<QString, Histogram>::ConstIterator it = tit.value().constBegin(), end = tit.value().constEnd();
+        for (; it != end; ++it) {
+            Data::Func &f = thdata.funcs[it.key()];
+            f.p50Ms = it.value().percentileNs(50) * 0.000001;
+            f.p90Ms = it.value().percentileNs(90) * 0.000001;
+            f.p99Ms = it.value().percentileNs(99) * 0.000001;
+            f.maxMs = it.value().maxNs * 0.000001;
         }
     }
 
-    m_detector.lockIfNeed(index);
+    return data;
+}
 
-    FuncTimer *timer = m_funcs.timers[index].value(&func, NULL);
-    if (!timer) {
-        timer = new FuncTimer(func);
-        m_funcs.timers[index].insert(&func, timer);
-    } else {
-        if (timer->timer.isValid()) {
-            printer()->printDebug(QString("Recursion detected, measure only first call, func: ") + func);
-            return;
-        }
-    }
-    
-    timer->timer.start();
+QString Profiler::threadsDataString(Data::Mode mode) const
+{
+    Profiler::Data data = threadsData(mode);
+    return printer()->formatData(data, mode, m_options.dataTopCount);
+}
 
-    m_detector.unlockIfNeed(index);
+void Profiler::printThreadsData(Data::Mode mode) const
+{
+    Profiler::Data data = threadsData(mode);
+    printer()->printData(data, mode, m_options.dataTopCount);
 }
 
-void Profiler::endFunc(const QString &func, quintptr th)
+void Profiler::takeWindowSnapshot()
 {
-    int index = m_funcs.threadIndex(th);
-    if (index == -1) {
-        return;
+    //! NOTE Instrumented threads are not stopped, counters are read as is
+    WindowSnapshot snapshot;
+    snapshot.generation = m_funcs.generation.load();
+    snapshot.ns = nowNs();
+    snapshot.data = collectData(Data::All, false); //! NOTE Only counters of functions, deltas are without call tree and percentiles
+
+    QMutexLocker locker(&m_windows.mutex);
+    if (!m_windows.snapshots.isEmpty() && m_windows.snapshots.last().generation != snapshot.generation) {
+        m_windows.snapshots.clear(); //! NOTE Cleared, cumulative data is started again
     }
 
-    m_detector.lockIfNeed(index);
-    
-    FuncTimer *timer = m_funcs.timers[index].value(&func, NULL);
-    if (timer) {
-        if (timer->timer.isValid()) { //! NOTE If not valid then it is probably a recursive call
+    m_windows.snapshots.append(snapshot);
+    while (m_windows.snapshots.count() > m_options.windowCount + 1) {
+        m_windows.snapshots.removeFirst();
+    }
+}
 
-            double calltimeMs = timer->timer.nsecsElapsed() * 0.000001; //! NOTE To millisecond
+Profiler::Data Profiler::deltaData(const WindowSnapshot &cur, const WindowSnapshot &prev, Data::Mode mode)
+{
+    Data data;
+    data.mainThread = cur.data.mainThread;
+    data.durationMs = (cur.ns - prev.ns) * 0.000001;
 
-            timer->callcount++;
-            timer->sumtimeMs += calltimeMs;
-            timer->timer.invalidate();
+    QHash<quintptr, Data::Thread>::ConstIterator tit = cur.data.threads.constBegin(), tend = cur.data.threads.constEnd();
+    for (; tit != tend; ++tit) {
 
-            if (m_options.funcsTraceEnabled) {
-                printer()->printTrace(func, calltimeMs, timer->callcount, timer->sumtimeMs);
-            }
+        bool isMain = tit.key() == data.mainThread;
+        if ((isMain && mode == Data::OnlyOther) || (!isMain && mode == Data::OnlyMain)) {
+            continue;
+        }
 
-            if (index == MAIN_THREAD_INDEX && m_detector.enabled && calltimeMs > m_options.longFuncThreshold) {
-                printer()->printEndLongFunc(func, calltimeMs);
+        const QHash<QString, Data::Func> prevFuncs = prev.data.threads.value(tit.key()).funcs;
+        QHash<QString, Data::Func>::ConstIterator it = tit.value().funcs.constBegin(), end = tit.value().funcs.constEnd();
+        for (; it != end; ++it) {
+            const Data::Func &c = it.value();
+            const Data::Func p = prevFuncs.value(it.key());
+            if (c.callcount <= p.callcount) {
+                continue;
             }
+
+            Data::Thread &thdata = data.threads[tit.key()];
+            thdata.thread = tit.key();
+
+            Data::Func &f = thdata.funcs[it.key()];
+            f.func = c.func;
+            f.callcount = c.callcount - p.callcount;
+            f.sumtimeMs = c.sumtimeMs - p.sumtimeMs;
+            f.selftimeMs = c.selftimeMs - p.selftimeMs;
+            f.callsPerSec = data.durationMs > 0 ? f.callcount * 1000.0 / data.durationMs : 0;
+            f.allocCount = c.allocCount - p.allocCount;
+            f.allocBytes = c.allocBytes - p.allocBytes;
+            f.cycles = c.cycles - p.cycles;
+            f.instructions = c.instructions - p.instructions;
+            f.cacheMisses = c.cacheMisses - p.cacheMisses;
+            f.branchMisses = c.branchMisses - p.branchMisses;
+            f.contextSwitches = c.contextSwitches - p.contextSwitches;
+            f.cpuTimeMs = c.cpuTimeMs - p.cpuTimeMs;
         }
     }
 
-    m_detector.unlockIfNeed(index);
+    return data;
 }
 
-const QString& Profiler::staticInfo(const QString &info)
+Profiler::Data Profiler::windowData(int count, Data::Mode mode) const
 {
-    int count = m_funcs.staticInfo.count();
-    for (int i = 0; i < count; ++i) {
-        if (m_funcs.staticInfo.at(i) == info) {
-            return m_funcs.staticInfo.at(i);
-        }
+    QMutexLocker locker(&m_windows.mutex);
+    int n = m_windows.snapshots.count();
+    if (n < 2 || count < 1) {
+        Data data;
+        data.mainThread = reinterpret_cast<quintptr>(qApp ? qApp->thread() : 0);
+        return data;
     }
 
-    m_funcs.staticInfo.append(info);
-    return m_funcs.staticInfo.last();
+    count = qMin(count, n - 1);
+    return deltaData(m_windows.snapshots.at(n - 1), m_windows.snapshots.at(n - 1 - count), mode);
 }
 
-double Profiler::StepTimer::beginMs() const
+QList<Profiler::Data> Profiler::windowsHistory(Data::Mode mode) const
 {
-    return this->beginTime.nsecsElapsed() * 0.000001; //! NOTE To millisecond
+    QMutexLocker locker(&m_windows.mutex);
+    QList<Data> history;
+    for (int i = 1; i < m_windows.snapshots.count(); ++i) {
+        history.append(deltaData(m_windows.snapshots.at(i), m_windows.snapshots.at(i - 1), mode));
+    }
+    return history;
 }
 
-double Profiler::StepTimer::stepMs() const
+QString Profiler::windowDataString(int count, Data::Mode mode) const
 {
-    return this->stepTime.nsecsElapsed() * 0.000001; //! NOTE To millisecond
+    Profiler::Data data = windowData(count, mode);
+    return printer()->formatData(data, mode, m_options.dataTopCount);
 }
 
-void Profiler::StepTimer::start()
+QString Profiler::callTreeString(Data::Mode mode) const
 {
-    this->beginTime.start();
-    this->stepTime.start();
+    Profiler::Data data = threadsData(mode);
+    return printer()->formatCallTree(data, mode);
 }
-void Profiler::StepTimer::restart()
+
+QString Profiler::callersString(const QString &func, Data::Mode mode) const
 {
-    this->beginTime.restart();
-    this->stepTime.restart();
+    Profiler::Data data = threadsData(mode);
+    return printer()->formatCallers(data, mode, func);
 }
 
-void Profiler::StepTimer::nextStep()
+void Profiler::printCallTree(Data::Mode mode) const
 {
-    this-> stepTime.restart();
+    printer()->printDebug(callTreeString(mode));
 }
 
-int Profiler::FuncsData::threadIndex(quintptr th) const
+QString Profiler::funcsFoldedString(Data::Mode mode, bool perThread) const
 {
-    int count = this->threads.count();
-    for (int i = 0; i < count; ++i) {
-        quintptr thi = this->threads[i];
-        if (thi == th) {
-            return i;
-        }
-        
-        if (thi == 0) {
-            return -1;
-        }
+    Profiler::Data data = threadsData(mode);
+    return printer()->formatFuncsFolded(data, mode, perThread);
+}
+
+bool Profiler::saveFuncsFolded(const QString &filePath, Data::Mode mode, bool perThread) const
+{
+    QFile file(filePath);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        printer()->printDebug(QString("Profiler can not open %1").arg(filePath));
+        return false;
     }
-    return -1;
+
+    return file.write(funcsFoldedString(mode, perThread).toUtf8()) != -1;
 }
 
-int Profiler::FuncsData::addThread(quintptr th)
+bool Profiler::startSampling(int hz)
 {
-    QMutexLocker locker(&this->mutex);
-    int index = threadIndex(th);
-    if (index > -1) {
-        return index;
+    if (!m_sampler) {
+        m_sampler = new CpuSampler();
     }
-    
-    int count = this->threads.count();
-    for (int i = 0; i < count; ++i) {
-        quintptr thi = this->threads[i];
-        if (thi == 0) {
-            this->threads[i] = th;
-            return i;
-        }
+
+    m_sampler->clear();
+    return m_sampler->start(hz);
+}
+
+void Profiler::stopSampling()
+{
+    if (m_sampler) {
+        m_sampler->stop();
     }
-    return -1;
 }
 
-void Profiler::clear()
+bool Profiler::isSampling() const
 {
-    QMutexLocker flocker(&m_funcs.mutex);
-    for (int i = 0; i < m_funcs.threads.count(); ++i) {
+    return m_sampler && m_sampler->isRunning();
+}
 
-        m_detector.lockIfNeed(i);
+QHash<QString, quint64> Profiler::sampledStacks(bool perThread) const
+{
+    return m_sampler ? m_sampler->stacks(perThread) : QHash<QString, quint64>();
+}
 
-        FuncTimers timers = m_funcs.timers[i];
-        qDeleteAll(timers);
-        m_funcs.timers[i] = FuncTimers();
-        m_funcs.threads[i] = 0;
+QString Profiler::sampledFoldedString(bool perThread) const
+{
+    return printer()->formatFolded(sampledStacks(perThread));
+}
 
-        m_detector.unlockIfNeed(i);
-    }
-    m_funcs.threads[MAIN_THREAD_INDEX] = reinterpret_cast<quintptr>(qApp->thread());
+QString Profiler::sampledTopString(int count) const
+{
+    return printer()->formatSamplesTop(sampledStacks(false), count);
+}
 
-    QMutexLocker slocker(&m_steps.mutex);
-    qDeleteAll(m_steps.timers);
-    m_steps.timers.clear();
+void Profiler::printSampledTop(int count) const
+{
+    printer()->printDebug(sampledTopString(count));
 }
 
-Profiler::Data Profiler::threadsData(Data::Mode mode) const
+static QByteArray jsonString(const QString &str)
 {
-    if (mode != Data::OnlyOther) {
-        m_detector.lockIfNeed(MAIN_THREAD_INDEX);
+    QByteArray utf8 = str.toUtf8();
+    QByteArray out;
+    out.reserve(utf8.size() + 2);
+    out.append('"');
+    for (int i = 0; i < utf8.size(); ++i) {
+        char c = utf8.at(i);
+        if (c == '"' || c == '\\') {
+            out.append('\\').append(c);
+        } else if (static_cast<uchar>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", static_cast<uchar>(c));
+            out.append(buf);
+        } else {
+            out.append(c);
+        }
     }
+    out.append('"');
+    return out;
+}
 
-    Data data;
-    data.mainThread = m_funcs.threads[MAIN_THREAD_INDEX];
+static QByteArray jsonUs(qint64 ns)
+{
+    return QByteArray::number(ns * 0.001, 'f', 3);
+}
 
-    for (int i = 0; i < m_funcs.threads.count(); ++i) {
+QByteArray Profiler::traceJson() const
+{
+    struct Begin {
+        int id;
+        qint64 ns;
+    };
 
-        quintptr th = m_funcs.threads[i];
-        if (th == 0) {
-            break;
+    const QVector<QString> fnames = funcNames();
+    QVector<TraceStepText> stexts;
+    {
+        QMutexLocker slocker(&m_steps.mutex);
+        stexts = m_steps.traceTexts;
+    }
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    const int generation = m_funcs.generation.load();
+
+    //! NOTE Copy events first, owner threads continue to write
+    QReadLocker locker(&m_funcs.lock);
+    const QList<ThreadData*> threads = m_funcs.threads;
+    QVector<QVector<TraceEvent> > events(threads.count());
+    QVector<QString> names(threads.count());
+    QVector<int> tids(threads.count());
+    qint64 baseNs = -1;
+    for (int t = 0; t < threads.count(); ++t) {
+        ThreadData *td = threads.at(t);
+        names[t] = td->name;
+        tids[t] = td->tid > 0 ? td->tid : t + 1; //! NOTE Kernel thread id, as in perf and other tools
+        const TraceEvent *trace = td->trace.loadAcquire();
+        qint64 count = td->traceCount.loadAcquire();
+        if (!trace || count == 0 || td->generation != generation) {
+            continue;
         }
 
-        if (i == MAIN_THREAD_INDEX) {
-            if (mode == Data::OnlyOther) {
-                continue;
-            }
-        } else {
-            if (mode == Data::OnlyMain) {
-                continue;
-            }
+        qint64 begin = count > td->traceCapacity ? count - td->traceCapacity : 0;
+        QVector<TraceEvent> &tevents = events[t];
+        tevents.reserve(count - begin);
+        for (qint64 i = begin; i < count; ++i) {
+            tevents.append(trace[i % td->traceCapacity]);
         }
 
-        Data::Thread thdata;
-        thdata.thread = th;
-
-        FuncTimers timers = m_funcs.timers[i];
-        foreach (const FuncTimer* ft, timers) {
-            Data::Func f(
-                        ft->func,
-                        ft->callcount,
-                        ft->sumtimeMs
-                        );
+        //! NOTE The owner could overwrite the oldest events during the copy (and is writing the next one), they are dropped
+        std::atomic_thread_fence(std::memory_order_acquire);
+        qint64 written = td->traceCount.loadAcquire();
+        qint64 valid = written - td->traceCapacity + 1;
+        if (valid > begin) {
+            tevents.remove(0, qMin<qint64>(valid - begin, tevents.count()));
+        }
 
-            thdata.funcs[f.func] = f;
+        if (tevents.isEmpty()) {
+            continue;
         }
 
-        data.threads[thdata.thread] = thdata;
+        if (baseNs == -1 || tevents.first().ns < baseNs) {
+            baseNs = tevents.first().ns;
+        }
+    }
+    locker.unlock();
+
+    QByteArray json;
+    json.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    for (int t = 0; t < threads.count(); ++t) {
+        const QVector<TraceEvent> &tevents = events.at(t);
+        if (tevents.isEmpty()) {
+            continue;
+        }
 
-        if (i == MAIN_THREAD_INDEX) {
-            if (mode == Data::OnlyMain) {
-                break;
+        const QByteArray tid = QByteArray::number(tids.at(t));
+        const QByteArray head = "{\"pid\":" + pid + ",\"tid\":" + tid + ",";
+
+        json.append(first ? "\n" : ",\n");
+        first = false;
+        json.append(head).append("\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":")
+            .append(jsonString(names.at(t))).append("}}");
+
+        //! NOTE Pairs of begin and end are complete events, the end without begin (overwritten) is skipped
+        QVector<Begin> stack;
+        foreach (const TraceEvent &e, tevents) {
+            switch (e.type) {
+            case TraceBegin: {
+                Begin b = { e.id, e.ns };
+                stack.append(b);
+            } break;
+            case TraceEnd: {
+                if (stack.isEmpty() || stack.last().id != e.id) {
+                    stack.clear();
+                    break;
+                }
+                Begin b = stack.takeLast();
+                json.append(",\n").append(head).append("\"ph\":\"X\",\"name\":").append(jsonString(fnames.value(b.id)))
+                    .append(",\"ts\":").append(jsonUs(b.ns - baseNs)).append(",\"dur\":").append(jsonUs(e.ns - b.ns)).append("}");
+            } break;
+            case TraceStep: {
+                bool hasText = e.id >= 0 && e.id < stexts.count() && stexts.at(e.id).ns == e.ns;
+                const QString name = hasText ? stexts.at(e.id).text : QString("step");
+                json.append(",\n").append(head).append("\"ph\":\"i\",\"s\":\"t\",\"name\":").append(jsonString(name))
+                    .append(",\"ts\":").append(jsonUs(e.ns - baseNs)).append("}");
+            } break;
             }
         }
-    }
 
-    if (mode != Data::OnlyOther) {
-        m_detector.unlockIfNeed(MAIN_THREAD_INDEX);
+        //! NOTE Functions still running at capture time
+        foreach (const Begin &b, stack) {
+            json.append(",\n").append(head).append("\"ph\":\"B\",\"name\":").append(jsonString(fnames.value(b.id)))
+                .append(",\"ts\":").append(jsonUs(b.ns - baseNs)).append("}");
+        }
     }
-
-    return data;
+    json.append("\n]}\n");
+    return json;
 }
 
-QString Profiler::threadsDataString(Data::Mode mode) const
+bool Profiler::saveTrace(const QString &filePath) const
 {
-    Profiler::Data data = threadsData(mode);
-    return printer()->formatData(data, mode, m_options.dataTopCount);
-}
+    QFile file(filePath);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        printer()->printDebug(QString("Profiler can not open %1").arg(filePath));
+        return false;
+    }
 
-void Profiler::printThreadsData(Data::Mode mode) const
-{
-    Profiler::Data data = threadsData(mode);
-    printer()->printData(data, mode, m_options.dataTopCount);
+    return file.write(traceJson()) != -1;
 }
 
-void Profiler::LongFuncDetector::lockIfNeed(int index)
+int Profiler::ThreadData::stackSnapshot(Frame *frames) const
 {
-    if (index == MAIN_THREAD_INDEX && this->enabled && this->needLock) {
-        this->mutex.lock();
-        this->locked = true;
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        int seq = stackSeq.loadAcquire();
+        if (seq & 1) { //! NOTE The owner is changing the stack now
+            continue;
+        }
+
+        int count = qBound(0, depth, static_cast<int>(STACK_MAX_DEPTH));
+        memcpy(frames, stack, count * sizeof(Frame));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (stackSeq.load() == seq) {
+            return count;
+        }
     }
+    return -1;
 }
 
-void Profiler::LongFuncDetector::unlockIfNeed(int index)
+void Profiler::publishThresholds(const LongFuncThresholds *thresholds)
 {
-    if (index == MAIN_THREAD_INDEX && this->locked) {
-        this->mutex.unlock();
-        this->locked = false;
+    //! NOTE Readers can still use old thresholds at any time, there is no reference or epoch, so it is not deleted
+    const LongFuncThresholds *old = m_detector.thresholds.fetchAndStoreOrdered(thresholds);
+    if (old) {
+        m_detector.retired.append(old);
     }
 }
 
-struct IsLessByTime {
-    bool operator()(const QPair<quint64, QString> &f, const QPair<quint64, QString> &s)
-    {
-        return f.first > s.first;
+int Profiler::longFuncThreshold(const ThreadData *td, int funcId) const
+{
+    const LongFuncThresholds *thresholds = m_detector.thresholds.loadAcquire();
+    if (!thresholds) {
+        return td->longFuncThreshold;
     }
-};
+
+    QHash<int, int>::ConstIterator it = thresholds->byFunc.constFind(funcId);
+    return it != thresholds->byFunc.constEnd() ? it.value() : td->longFuncThreshold;
+}
 
 //! NOTE Сalled timeout timer, which is in background thread
 void Profiler::th_checkLongFuncs()
 {
-    QList< QPair<quint64, QString> > longFuncs;
+    struct Report {
+        bool isMain;
+        int tid;
+        QString name;
+        QStringList funcs;
+    };
+
+    //! NOTE Threads are not blocked, stacks are read by seqlock, the lock only keeps the data of finished threads.
+    //! Native stacks and printing are after unlock: capture waits for the thread, a printer can call the profiler
+    QList<Report> reports;
+    qint64 now = nowNs();
+    {
+        QReadLocker locker(&m_funcs.lock);
+        foreach (const ThreadData *td, m_funcs.threads) {
+            if (td->alive.loadAcquire() == 0) {
+                continue;
+            }
 
-    { // находим незавершенные зависшие функции
+            if (td->isMain || m_options.longFuncDetectorAllThreads) {
+                Report r;
+                r.funcs = checkLongFuncs(td, now);
+                if (!r.funcs.isEmpty()) {
+                    r.isMain = td->isMain;
+                    r.tid = td->tid;
+                    r.name = td->name;
+                    reports.append(r);
+                }
+            }
+        }
+    }
 
-        m_detector.needLock = true;
-        Sleep::msleep(10); //! NOTE Let's wait to come out of the thread of execution beginFunc and endFunc
+    for (int i = 0; i < reports.count(); ++i) {
+        Report &r = reports[i];
 
-        QMutexLocker locker(&m_detector.mutex);
-        foreach (const FuncTimer *f, m_funcs.timers[MAIN_THREAD_INDEX]) {
-            if (f->timer.isValid()) {
-                qint64 elapsed = f->timer.elapsed();
-                if (elapsed > m_options.longFuncThreshold) {
-                    longFuncs.append(QPair<qint64, QString>(elapsed, QString("%1: %2 ms").arg(f->func).arg(elapsed)));
-                }
+        //! NOTE The thread can be finished after unlock, then capture is empty (tgkill fails)
+        if (m_options.longFuncNativeStack) {
+            QVector<void *> native = NativeStack::capture(r.tid);
+            if (!native.isEmpty()) {
+                r.funcs.append("Native stack:");
+                r.funcs.append(NativeStack::symbolize(native));
             }
         }
+
+        if (r.isMain) {
+            printer()->printLongFuncs(r.funcs);
+        } else {
+            printer()->printThreadLongFuncs(r.name, r.funcs);
+        }
     }
+}
 
-    m_detector.needLock = false;
-    std::sort(longFuncs.begin(), longFuncs.end(), IsLessByTime()); //! NOTE Sorting by time, as a result we obtain a stack of the main thread
+QStringList Profiler::checkLongFuncs(const ThreadData *td, qint64 now) const
+{
+    Frame frames[STACK_MAX_DEPTH];
+    int depth = td->stackSnapshot(frames);
 
     QStringList funcs;
-    for (int i = 0; i < longFuncs.count(); ++i) {
-        funcs.append(longFuncs.at(i).second);
-    }
+    QSet<int> found;
+    for (int i = 0; i < depth; ++i) { //! NOTE From the outermost, as a result we obtain a stack of the thread
+        const Frame &f = frames[i];
+        if (f.beginNs == 0 || found.contains(f.funcId)) { //! NOTE Recursive calls are inside the outermost
+            continue;
+        }
 
-    if (!funcs.isEmpty()) {
-        printer()->printLongFuncs(funcs);
+        qint64 elapsed = (now - f.beginNs) / 1000000;
+        if (elapsed > longFuncThreshold(td, f.funcId)) {
+            found.insert(f.funcId);
+            funcs.append(QString("%1: %2 ms").arg(funcName(f.funcId)).arg(elapsed));
+        }
     }
+
+    return funcs;
 }
 
 const Profiler::Options& Profiler::options()
@@ -461,6 +1455,19 @@ void Profiler::Printer::printLongFuncs(const QStringList &funcsStack)
     printInfo(str);
 }
 
+void Profiler::Printer::printThreadLongFuncs(const QString &thread, const QStringList &funcsStack)
+{
+    QString str;
+    str.reserve(100);
+    str
+            .append("Long functions on thread ")
+            .append(thread)
+            .append(":\n")
+            .append(funcsStack.join("\n"));
+
+    printInfo(str);
+}
+
 void Profiler::Printer::printEndLongFunc(const QString &func, double calltimeMs)
 {
     QString str;
@@ -526,12 +1533,270 @@ QString Profiler::Printer::formatData(const Data &data, Data::Mode mode, int max
 
 void Profiler::Printer::funcsToStream(QTextStream &stream, const QString &title, const QList<Data::Func> &funcs, int _count) const
 {
+    //! NOTE Rate column only for window data, percentiles, allocation and counters columns only if tracked
+    bool hasRate = false;
+    bool hasHistogram = false;
+    bool hasAlloc = false;
+    bool hasPerf = false;
+    foreach (const Data::Func &f, funcs) {
+        hasRate = hasRate || f.callsPerSec > 0;
+        hasHistogram = hasHistogram || f.maxMs > 0;
+        hasAlloc = hasAlloc || f.allocCount > 0;
+        hasPerf = hasPerf || f.cpuTimeMs > 0 || f.cycles > 0;
+    }
+
     stream << title << "\n";
-    stream << FORMAT("Function", 60) << TITLE("Call time") << TITLE("Call count") << TITLE("Sum time") << "\n";
+    stream << FORMAT("Function", 60) << TITLE("Call time") << TITLE("Call count") << TITLE("Sum time") << TITLE("Self time");
+    if (hasHistogram) {
+        stream << TITLE("p50") << TITLE("p90") << TITLE("p99") << TITLE("Max");
+    }
+    if (hasRate) {
+        stream << TITLE("Calls/s");
+    }
+    if (hasAlloc) {
+        stream << TITLE("Allocs") << TITLE("Alloc bytes");
+    }
+    if (hasPerf) {
+        stream << TITLE("CPU time") << TITLE("IPC") << TITLE("Cache MPKI") << TITLE("Branch MPKI") << TITLE("Ctx switches");
+    }
+    stream << "\n";
     int count = funcs.count() < _count ? funcs.count() : _count;
     for (int i = 0; i < count; ++i) {
         const Data::Func &f = funcs.at(i);
-        stream << FORMAT(f.func, 60) << VALUE_D(f.callcount ? (f.sumtimeMs / static_cast<double>(f.callcount)) : 0, " ms") << VALUE(f.callcount, "") << VALUE_D(f.sumtimeMs, " ms") << "\n";
+        stream << FORMAT(f.func, 60) << VALUE_D(f.callcount ? (f.sumtimeMs / static_cast<double>(f.callcount)) : 0, " ms") << VALUE(f.callcount, "") << VALUE_D(f.sumtimeMs, " ms") << VALUE_D(f.selftimeMs, " ms");
+        if (hasHistogram) {
+            stream << VALUE_D(f.p50Ms, " ms") << VALUE_D(f.p90Ms, " ms") << VALUE_D(f.p99Ms, " ms") << VALUE_D(f.maxMs, " ms");
+        }
+        if (hasRate) {
+            stream << VALUE_D(f.callsPerSec, "");
+        }
+        if (hasAlloc) {
+            stream << VALUE(f.allocCount, "") << VALUE(f.allocBytes, "");
+        }
+        if (hasPerf) {
+            //! NOTE Misses per 1000 instructions, IPC and MPKI are 0 without hardware counters
+            stream << VALUE_D(f.cpuTimeMs, " ms") << VALUE_D(f.cycles > 0 ? f.instructions / f.cycles : 0, "")
+                   << VALUE_D(f.instructions > 0 ? f.cacheMisses * 1000 / f.instructions : 0, "")
+                   << VALUE_D(f.instructions > 0 ? f.branchMisses * 1000 / f.instructions : 0, "")
+                   << VALUE_D(f.contextSwitches, "");
+        }
+        stream << "\n";
+    }
+    stream << "\n\n";
+}
+
+struct IsNodeLessBySum {
+    const QVector<Profiler::Data::Node> &nodes;
+    explicit IsNodeLessBySum(const QVector<Profiler::Data::Node> &n) : nodes(n) {}
+    bool operator()(int f, int s) const
+    {
+        return nodes.at(f).sumtimeMs > nodes.at(s).sumtimeMs;
+    }
+};
+
+QString Profiler::Printer::formatCallTree(const Data &data, Data::Mode mode) const
+{
+    QString str;
+    QTextStream stream(&str);
+    stream << "\n\n";
+
+    QHash<quintptr, Data::Thread>::ConstIterator it = data.threads.constBegin(), end = data.threads.constEnd();
+    while (it != end) {
+
+        bool isMain = it.key() == data.mainThread;
+        if ((isMain && mode == Data::OnlyOther) || (!isMain && mode == Data::OnlyMain) || it.value().nodes.isEmpty()) {
+            ++it;
+            continue;
+        }
+
+        stream << (isMain ? QString("Main thread. Call tree") : QString("Thread %1. Call tree").arg(it.key(), 0, 16)) << "\n";
+        stream << FORMAT("Function", 60) << TITLE("Call count") << TITLE("Sum time") << TITLE("Self time") << "\n";
+        nodesToStream(stream, it.value().nodes, 0, -1);
+        stream << "\n\n";
+
+        ++it;
+    }
+
+    return str;
+}
+
+QString Profiler::Printer::formatCallers(const Data &data, Data::Mode mode, const QString &func) const
+{
+    //! NOTE Inverted tree: the function is the root, children are callers, by paths to the root of call tree
+    QVector<Data::Node> callers;
+    callers.append(Data::Node());
+    callers[0].func = func;
+
+    QHash<quintptr, Data::Thread>::ConstIterator it = data.threads.constBegin(), end = data.threads.constEnd();
+    while (it != end) {
+
+        bool isMain = it.key() == data.mainThread;
+        if ((isMain && mode == Data::OnlyOther) || (!isMain && mode == Data::OnlyMain)) {
+            ++it;
+            continue;
+        }
+
+        const QVector<Data::Node> &nodes = it.value().nodes;
+        for (int i = 0; i < nodes.count(); ++i) {
+            const Data::Node &n = nodes.at(i);
+            if (n.func != func) {
+                continue;
+            }
+
+            callers[0].callcount += n.callcount;
+            callers[0].sumtimeMs += n.sumtimeMs;
+            callers[0].selftimeMs += n.selftimeMs;
+
+            int cur = 0;
+            for (int p = n.parent; p > 0; p = nodes.at(p).parent) {
+                const QString &caller = nodes.at(p).func;
+
+                int child = -1;
+                foreach (int c, callers.at(cur).children) {
+                    if (callers.at(c).func == caller) {
+                        child = c;
+                        break;
+                    }
+                }
+
+                if (child == -1) {
+                    child = callers.count();
+                    callers.append(Data::Node());
+                    callers[child].func = caller;
+                    callers[child].parent = cur;
+                    callers[cur].children.append(child);
+                }
+
+                //! NOTE Values of the function, called through this path
+                callers[child].callcount += n.callcount;
+                callers[child].sumtimeMs += n.sumtimeMs;
+                callers[child].selftimeMs += n.selftimeMs;
+                cur = child;
+            }
+        }
+
+        ++it;
+    }
+
+    QString str;
+    QTextStream stream(&str);
+    stream << "\n\n";
+    stream << QString("Callers of %1").arg(func) << "\n";
+    stream << FORMAT("Function", 60) << TITLE("Call count") << TITLE("Sum time") << TITLE("Self time") << "\n";
+    nodesToStream(stream, callers, 0, 0);
+    stream << "\n\n";
+    return str;
+}
+
+void Profiler::Printer::nodesToStream(QTextStream &stream, const QVector<Data::Node> &nodes, int index, int depth) const
+{
+    const Data::Node &n = nodes.at(index);
+    if (depth >= 0) {
+        stream << FORMAT(QString(depth * 2, ' ') + n.func, 60) << VALUE(n.callcount, "") << VALUE_D(n.sumtimeMs, " ms") << VALUE_D(n.selftimeMs, " ms") << "\n";
+    }
+
+    QList<int> children = n.children;
+    std::sort(children.begin(), children.end(), IsNodeLessBySum(nodes));
+    foreach (int c, children) {
+        nodesToStream(stream, nodes, c, depth + 1);
+    }
+}
+
+QString Profiler::Printer::formatFolded(const QHash<QString, quint64> &stacks) const
+{
+    QStringList keys = stacks.keys();
+    std::sort(keys.begin(), keys.end());
+
+    QString str;
+    QTextStream stream(&str);
+    foreach (const QString &stack, keys) {
+        stream << stack << " " << stacks.value(stack) << "\n";
+    }
+    return str;
+}
+
+//! NOTE ';' separates frames of folded stack, it can be in names (templates of GCC: [with T = int; U = int])
+static QString foldedFrame(const QString &name)
+{
+    QString frame = name;
+    return frame.replace(';', ',');
+}
+
+QString Profiler::Printer::formatFuncsFolded(const Data &data, Data::Mode mode, bool perThread) const
+{
+    QHash<QString, quint64> stacks;
+    QHash<quintptr, Data::Thread>::ConstIterator it = data.threads.constBegin(), end = data.threads.constEnd();
+    for (; it != end; ++it) {
+
+        bool isMain = it.key() == data.mainThread;
+        if ((isMain && mode == Data::OnlyOther) || (!isMain && mode == Data::OnlyMain)) {
+            continue;
+        }
+
+        //! NOTE Parent is added before children, so its path is ready
+        const QVector<Data::Node> &nodes = it.value().nodes;
+        QVector<QString> paths(nodes.count());
+        if (perThread && !nodes.isEmpty()) {
+            paths[0] = isMain ? QString("main") : QString("thread 0x%1").arg(it.key(), 0, 16);
+        }
+
+        for (int i = 1; i < nodes.count(); ++i) {
+            const Data::Node &n = nodes.at(i);
+            const QString &parentPath = paths.at(n.parent);
+            paths[i] = parentPath.isEmpty() ? foldedFrame(n.func) : parentPath + ';' + foldedFrame(n.func);
+
+            quint64 selfNs = static_cast<quint64>(qMax(0.0, n.selftimeMs) * 1000000.0 + 0.5);
+            if (selfNs > 0) {
+                stacks[paths.at(i)] += selfNs;
+            }
+        }
+    }
+
+    return formatFolded(stacks);
+}
+
+struct IsLessBySamples {
+    const QHash<QString, QPair<quint64, quint64> > &funcs;
+    explicit IsLessBySamples(const QHash<QString, QPair<quint64, quint64> > &f) : funcs(f) {}
+    bool operator()(const QString &f, const QString &s) const
+    {
+        return funcs.value(f).first > funcs.value(s).first;
+    }
+};
+
+QString Profiler::Printer::formatSamplesTop(const QHash<QString, quint64> &stacks, int count) const
+{
+    //! NOTE Self - the function is on the top of stack, total - the function is in the stack (once, for recursion)
+    QHash<QString, QPair<quint64, quint64> > funcs;
+    quint64 total = 0;
+    QHash<QString, quint64>::ConstIterator it = stacks.constBegin(), end = stacks.constEnd();
+    for (; it != end; ++it) {
+        QStringList frames = it.key().split(';');
+        total += it.value();
+        funcs[frames.last()].first += it.value();
+
+        QSet<QString> counted;
+        foreach (const QString &f, frames) {
+            if (!counted.contains(f)) {
+                counted.insert(f);
+                funcs[f].second += it.value();
+            }
+        }
+    }
+
+    QStringList names = funcs.keys();
+    std::sort(names.begin(), names.end(), IsLessBySamples(funcs));
+
+    QString str;
+    QTextStream stream(&str);
+    stream << "\n\n";
+    stream << QString("Top %1 by self samples (total samples: %2)").arg(count).arg(total) << "\n";
+    stream << FORMAT("Function", 60) << TITLE("Self") << TITLE("Self %") << TITLE("Total") << TITLE("Total %") << "\n";
+    for (int i = 0; i < names.count() && i < count; ++i) {
+        const QPair<quint64, quint64> &f = funcs[names.at(i)];
+        stream << FORMAT(names.at(i), 60) << VALUE(f.first, "") << VALUE_D(total ? 100.0 * f.first / total : 0, " %")
+               << VALUE(f.second, "") << VALUE_D(total ? 100.0 * f.second / total : 0, " %") << "\n";
     }
     stream << "\n\n";
+    return str;
 }
@@ -2,13 +2,21 @@
 #define PROFILER_H
 
 #include <QString>
+#include <QStringList>
 #include <QVector>
 #include <QElapsedTimer>
 #include <QMutex>
+#include <QReadWriteLock>
 #include <QHash>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QAtomicInteger>
+#include <QByteArray>
 #include <QTextStream>
 #include <QThread>
 #include <QTimer>
+#include <atomic>
+#include "perfcounters.h"
 
 #ifndef BEGIN_STEP_TIME
 #define BEGIN_STEP_TIME(tag) if (Profiler::options().stepTimeEnabled) { Profiler::instance()->stepTime(tag, QString("Begin"), true); }
@@ -19,21 +27,27 @@
 #endif
 
 
+//! NOTE Function id is registered once, on first call (static init)
 #ifndef TRACEFUNC
 #define TRACEFUNC \
-    static QString __func_info(Q_FUNC_INFO); \
-    QZebraDev::FuncMarker __funcMarker(__func_info);
+    static const int __func_id = QZebraDev::Profiler::funcId(Q_FUNC_INFO); \
+    QZebraDev::FuncMarker __funcMarker(__func_id);
 #endif
 
 
+//! NOTE The slow path, info is dynamic, so it is looked up on each call (read lock and hash of the string).
+//! For hot functions use TRACEFUNC
 #ifndef TRACEFUNC_INFO
 #define TRACEFUNC_INFO(info) \
-    QZebraDev::FuncMarker __funcMarkerInfo(Profiler::instance()->staticInfo(info));
+    QZebraDev::FuncMarker __funcMarkerInfo(QZebraDev::Profiler::funcId(info));
 #endif
 
 
 namespace QZebraDev {
 
+class CpuSampler;
+struct ProfilerAllocHook;
+
 class Profiler: public QObject
 {
     Q_OBJECT
@@ -52,17 +66,37 @@ public:
 
         bool funcsTimeEnabled;
         bool funcsTraceEnabled;
-        int funcsMaxThreadCount;
+        bool funcsCallTreeEnabled;  //! NOTE Calling context tree, see callTreeString, callersString
+        bool funcsHistogramEnabled; //! NOTE Latency histogram of functions, for percentiles (~3 KB per function and thread)
+        int funcsSampleRate;        //! NOTE Time 1 of N calls of each function (per thread), counts are exact, times are scaled (the long function detector sees all calls)
+        bool funcsAllocEnabled;     //! NOTE Heap allocations of functions, needs QZebraDev_PROFILER_ALLOC, see profileralloc.cpp
+        bool funcsPerfCountersEnabled; //! NOTE Cycles, instructions, misses, CPU time of sampled calls, syscalls without rdpmc, see PerfCounters
+        int funcsMaxThreadCount;    //! NOTE Data of finished threads is kept, over the limit the oldest finished is dropped
 
         bool longFuncDetectorEnabled;
+        bool longFuncDetectorAllThreads;            //! NOTE Else only the main thread
         int longFuncThreshold;
+        QHash<QString, int> longFuncThreadThresholds; //! NOTE By QThread::objectName
+        QHash<QString, int> longFuncFuncThresholds;   //! NOTE By function (Q_FUNC_INFO), over thread thresholds
+        bool longFuncNativeStack;                   //! NOTE Capture native stack of stalled thread, see NativeStack (Linux)
 
         int dataTopCount;
 
+        bool traceCaptureEnabled;   //! NOTE Timeline of functions and steps, see traceJson, saveTrace
+        int traceBufferSize;        //! NOTE Events per thread, ring buffer, the oldest are overwritten
+
+        int windowIntervalMs;       //! NOTE Rolling windows, 0 - disabled, see windowData, windowsHistory
+        int windowCount;
+
         Options() : stepTimeEnabled(true),
-            funcsTimeEnabled(true), funcsTraceEnabled(false), funcsMaxThreadCount(100),
-            longFuncDetectorEnabled(true), longFuncThreshold(1000),
-            dataTopCount(150){}
+            funcsTimeEnabled(true), funcsTraceEnabled(false), funcsCallTreeEnabled(false), funcsHistogramEnabled(false),
+            funcsSampleRate(1), funcsAllocEnabled(false), funcsPerfCountersEnabled(false),
+            funcsMaxThreadCount(100),
+            longFuncDetectorEnabled(true), longFuncDetectorAllThreads(false), longFuncThreshold(1000),
+            longFuncNativeStack(false),
+            dataTopCount(150),
+            traceCaptureEnabled(false), traceBufferSize(256 * 1024),
+            windowIntervalMs(0), windowCount(60){}
     };
 
     struct Data {
@@ -76,21 +110,50 @@ public:
         struct Func {
             QString func;
             uint callcount;  
+            double sumtimeMs;   //! NOTE Inclusive, with callees, recursive calls are counted once
+            double selftimeMs;  //! NOTE Exclusive, without instrumented callees
+            double p50Ms;       //! NOTE Percentiles of call time, by histogram (precision ~6%)
+            double p90Ms;
+            double p99Ms;
+            double maxMs;
+            double callsPerSec; //! NOTE Only for window data
+            quint64 allocCount; //! NOTE Exclusive, in the function itself, see Options::funcsAllocEnabled
+            quint64 allocBytes;
+            double cycles;      //! NOTE Inclusive, see Options::funcsPerfCountersEnabled, 0 if not available
+            double instructions;
+            double cacheMisses;
+            double branchMisses;
+            double contextSwitches;
+            double cpuTimeMs;
+            Func() : callcount(0), sumtimeMs(0), selftimeMs(0), p50Ms(0), p90Ms(0), p99Ms(0), maxMs(0), callsPerSec(0),
+                allocCount(0), allocBytes(0), cycles(0), instructions(0), cacheMisses(0), branchMisses(0), contextSwitches(0), cpuTimeMs(0) {}
+            Func(const QString& f, uint cc, double st, double self = 0)
+                : func(f), callcount(cc), sumtimeMs(st), selftimeMs(self), p50Ms(0), p90Ms(0), p99Ms(0), maxMs(0), callsPerSec(0),
+                  allocCount(0), allocBytes(0), cycles(0), instructions(0), cacheMisses(0), branchMisses(0), contextSwitches(0), cpuTimeMs(0) {}
+        };
+
+        //! NOTE Node of calling context tree, node 0 is the root (without function)
+        struct Node {
+            QString func;
+            int parent;
+            QList<int> children;
+            uint callcount;
             double sumtimeMs;
-            Func() : callcount(0), sumtimeMs(0) {}
-            Func(const QString& f, uint cc, double st)
-                : func(f), callcount(cc), sumtimeMs(st){}
+            double selftimeMs;
+            Node() : parent(-1), callcount(0), sumtimeMs(0), selftimeMs(0) {}
         };
 
         struct Thread {
             quintptr thread;
             QHash<QString, Func> funcs;
+            QVector<Node> nodes;
             Thread() : thread(0) {}
         };
 
         quintptr mainThread;
         QHash<quintptr, Thread> threads;
-        Data() : mainThread(0){}
+        double durationMs;  //! NOTE Duration of window data, 0 for totals
+        Data() : mainThread(0), durationMs(0){}
     };
 
     struct Printer {
@@ -100,10 +163,17 @@ public:
         virtual void printStep(const QString &tag, double beginMs, double stepMs, const QString &info);
         virtual void printTrace(const QString& func, double calltimeMs, qint64 callcount, double sumtimeMs);
         virtual void printLongFuncs(const QStringList &funcsStack);
+        virtual void printThreadLongFuncs(const QString &thread, const QStringList &funcsStack);
         virtual void printEndLongFunc(const QString &func, double calltimeMs);
         virtual void printData(const Data &data, Data::Mode mode, int maxcount);
         virtual QString formatData(const Data &data, Data::Mode mode, int maxcount) const;
         virtual void funcsToStream(QTextStream &stream, const QString &title, const QList<Data::Func> &funcs, int count) const;
+        virtual QString formatCallTree(const Data &data, Data::Mode mode) const;
+        virtual QString formatCallers(const Data &data, Data::Mode mode, const QString &func) const;
+        virtual void nodesToStream(QTextStream &stream, const QVector<Data::Node> &nodes, int index, int depth) const;
+        virtual QString formatFolded(const QHash<QString, quint64> &stacks) const; //! NOTE stack value, for flame graph tools
+        virtual QString formatSamplesTop(const QHash<QString, quint64> &stacks, int count) const;
+        virtual QString formatFuncsFolded(const Data &data, Data::Mode mode, bool perThread) const;
     };
 
     void setup(const Options &opt = Options(), Printer *printer = 0);
@@ -114,17 +184,45 @@ public:
 
     void stepTime(const QString &tag = "App", const QString &info = "", bool isRestart = false);
     
-    void beginFunc(const QString &func, const quintptr th);
-    void endFunc(const QString &func, const quintptr th);
-    
-    const QString& staticInfo(const QString &info); //! NOTE Сохраняет строки
-    
+    static int funcId(const QString &func); //! NOTE Dense id of function name, -1 if too many functions
+    static QString funcName(int funcId);
+    static int funcsCount();
+
+    void beginFunc(int funcId);
+    void endFunc(int funcId);
+
     void clear();
 
     Data threadsData(Data::Mode mode = Data::All) const;
 
     QString threadsDataString(Data::Mode mode = Data::All) const;
     void printThreadsData(Data::Mode mode = Data::All) const;
+
+    //! NOTE Deltas of the last windows (Options::windowIntervalMs), without percentiles and call tree
+    Data windowData(int count = 1, Data::Mode mode = Data::All) const;
+    QList<Data> windowsHistory(Data::Mode mode = Data::All) const; //! NOTE Each window, the oldest first
+    QString windowDataString(int count = 1, Data::Mode mode = Data::All) const;
+
+    QString callTreeString(Data::Mode mode = Data::All) const;               //! NOTE Top-down
+    QString callersString(const QString &func, Data::Mode mode = Data::All) const; //! NOTE Bottom-up, callers of the function
+    void printCallTree(Data::Mode mode = Data::All) const;
+
+    //! NOTE Folded stacks of call tree with self time (ns), for flame graph tools, needs funcsCallTreeEnabled
+    QString funcsFoldedString(Data::Mode mode = Data::All, bool perThread = false) const;
+    bool saveFuncsFolded(const QString &filePath, Data::Mode mode = Data::All, bool perThread = false) const;
+
+    //! NOTE Sampling CPU profiler (Linux), all threads, see CpuSampler
+    bool startSampling(int hz = 99);
+    void stopSampling();
+    bool isSampling() const;
+    QHash<QString, quint64> sampledStacks(bool perThread = true) const; //! NOTE Folded stack -> samples
+    QString sampledFoldedString(bool perThread = true) const;
+    QString sampledTopString(int count = 30) const;
+    void printSampledTop(int count = 30) const;
+
+    //! NOTE Chrome trace-event JSON, opens in chrome://tracing and Perfetto UI
+    QByteArray traceJson() const;
+    bool saveTrace(const QString &filePath) const;
     
 signals:
     void detectorStarted(int ms);
@@ -140,6 +238,10 @@ private:
     static Profiler *s_profiler;
 
     friend struct FuncMarker;
+    friend struct ProfilerAllocHook;
+
+    //! NOTE Called by the allocation interposer (profileralloc.cpp), counts to the innermost function of the thread
+    static void countAlloc(size_t size);
     
     struct StepTimer {
         QElapsedTimer beginTime;
@@ -152,72 +254,281 @@ private:
         void nextStep();
     };
 
+    struct TraceStepText {
+        qint64 ns;
+        QString text;
+        TraceStepText() : ns(0) {}
+    };
+
+    //! NOTE Texts of trace steps are a ring (traceBufferSize), id of step event is position in it,
+    //! the text is of the event if ns are equal, else it is overwritten
     struct StepsData {
-        QMutex mutex;
+        mutable QMutex mutex;
         QHash<QString, StepTimer*> timers;
+        QVector<TraceStepText> traceTexts;
+        int traceTextsPos;
+        StepsData() : traceTextsPos(0) {}
     };
     
-    struct FuncTimer {
-        const QString& func;
-        QElapsedTimer timer;
+    //! NOTE Log-linear histogram of call time (ns): values below 16 ns are exact,
+    //! above are 16 sub-buckets per power of two, up to 2^45 ns. Fixed size, O(1) record
+    struct Histogram {
+        enum {
+            SUB_BITS = 4,
+            SUB_COUNT = 1 << SUB_BITS,
+            MAX_SHIFT = 40,
+            BUCKETS_COUNT = (MAX_SHIFT + 2) * SUB_COUNT
+        };
+
+        quint32 counts[BUCKETS_COUNT];
+        quint64 count;
+        qint64 maxNs;
+
+        Histogram() { reset(); }
+        void reset();
+        void record(qint64 ns);
+        void merge(const Histogram &other);
+        qint64 percentileNs(double p) const;
+
+        static int bucketIndex(qint64 ns);
+        static qint64 bucketUpperNs(int index);
+    };
+
+    struct FuncStat {
+        qint64 beginNs;     //! NOTE Begin of the outermost sampled call, 0 if the function is not running
+        int activeCount;    //! NOTE Recursion, sampled calls
+        uint callcount;
+        uint sampledcount;  //! NOTE Timed calls, times are scaled by callcount / sampledcount
+        uint sampleCounter;
+        qint64 sumtimeNs;
+        qint64 selftimeNs;
+        QAtomicPointer<Histogram> histogram; //! NOTE Allocated on the first call
+        quint64 allocCount;
+        quint64 allocBytes;
+        PerfCounters::Values perf; //! NOTE Sums of sampled outermost calls, as sumtimeNs
+        FuncStat() : beginNs(0), activeCount(0), callcount(0), sampledcount(0), sampleCounter(0),
+            sumtimeNs(0), selftimeNs(0), histogram(0), allocCount(0), allocBytes(0) {}
+    };
+
+    //! NOTE Frame of shadow call stack
+    struct Frame {
+        int funcId;
+        int node;       //! NOTE Node of call tree, -1 if the tree is disabled
+        bool sampled;   //! NOTE Not sampled call is only counted, without time
+        bool perf;      //! NOTE Counters are read on begin, to perfBegin of the thread
+        qint64 beginNs;
+        qint64 childNs; //! NOTE Inclusive time of callees, to calculate self time
+    };
+
+    //! NOTE Node of calling context tree, (parent, function) is unique, children are linked list
+    struct Node {
+        int funcId;
+        int parent;
+        int firstChild;
+        int nextSibling;
         uint callcount;
-        double sumtimeMs;
-        explicit FuncTimer(const QString &f) : func(f), callcount(0), sumtimeMs(0) {}
+        uint sampledcount;
+        qint64 sumtimeNs;
+        qint64 selftimeNs;
+        Node() : funcId(-1), parent(-1), firstChild(-1), nextSibling(-1), callcount(0), sampledcount(0), sumtimeNs(0), selftimeNs(0) {}
     };
 
-    typedef QHash<const QString*, FuncTimer* > FuncTimers;
+    enum TraceEventType {
+        TraceBegin = 0,
+        TraceEnd,
+        TraceStep
+    };
+
+    //! NOTE Event of trace capture, id is function id or position of step text
+    struct TraceEvent {
+        qint64 ns;
+        int id;
+        int type;
+    };
+
+    enum {
+        FUNCS_CHUNK_SIZE = 256,
+        FUNCS_MAX_CHUNKS = 256,
+        STACK_MAX_DEPTH = 256,
+        NODES_CHUNK_SIZE = 4096,
+        NODES_MAX_CHUNKS = 256
+    };
+
+    //! NOTE Data of a thread, written only by the thread itself (thread_local pointer),
+    //! registered in the profiler on first use, readers walk registered threads.
+    //! Stats are indexed by function id, by chunks, chunks are allocated on first use and never moved
+    struct ThreadData {
+        quintptr thread;
+        QString name;   //! NOTE Object name of thread or address
+        int tid;        //! NOTE Kernel thread id, for native stack
+        bool isMain;
+        QAtomicInt alive;   //! NOTE 0 after the thread is finished, then it can be removed by registration of new thread
+        int longFuncThreshold; //! NOTE Threshold of thread, resolved by name on registration and setup
+        int generation; //! NOTE If the profiler was cleared, data is reset by the owner thread
+        QAtomicPointer<FuncStat> stats[FUNCS_MAX_CHUNKS];
+
+        Frame stack[STACK_MAX_DEPTH];
+        int depth;
+        int overflow;   //! NOTE Calls deeper than STACK_MAX_DEPTH are not measured
+        QAtomicInt stackSeq; //! NOTE Seqlock of stack, odd while the owner changes it, readers retry
+        bool inProfiler; //! NOTE Own allocations of the profiler are not counted
+
+        //! NOTE Opened by the thread on the first call with Options::funcsPerfCountersEnabled, 0 if not available
+        PerfCounters *perf;
+        PerfCounters::Values *perfBegin; //! NOTE By depth
+        bool perfOpened;
+
+        //! NOTE Arena of call tree nodes, by chunks, nodes are only appended
+        QAtomicPointer<Node> nodes[NODES_MAX_CHUNKS];
+        QAtomicInt nodesCount;
+
+        //! NOTE Ring buffer of trace events, allocated on first event
+        QAtomicPointer<TraceEvent> trace;
+        int traceCapacity;
+        QAtomicInteger<qint64> traceCount; //! NOTE Written events, position is traceCount % traceCapacity
+
+        ThreadData() : thread(0), tid(0), isMain(false), alive(1), longFuncThreshold(0), generation(0), depth(0), overflow(0), stackSeq(0), inProfiler(false),
+            perf(0), perfBegin(0), perfOpened(false), nodesCount(0),
+            trace(0), traceCapacity(0), traceCount(0) {}
+        ~ThreadData();
+
+        inline Node* node(int index) const
+        {
+            return &nodes[index / NODES_CHUNK_SIZE].loadAcquire()[index % NODES_CHUNK_SIZE];
+        }
+
+        int addNode(int parent, int funcId);
+        int childNode(int parent, int funcId);
+
+        inline void beginStackWrite()
+        {
+            stackSeq.store(stackSeq.load() + 1);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        inline void endStackWrite()
+        {
+            stackSeq.storeRelease(stackSeq.load() + 1);
+        }
+
+        //! NOTE Consistent copy of stack for other threads, without blocking the owner, -1 if failed
+        int stackSnapshot(Frame *frames) const;
+
+        inline FuncStat* stat(int funcId)
+        {
+            FuncStat *chunk = stats[funcId / FUNCS_CHUNK_SIZE].load();
+            if (!chunk) {
+                chunk = new FuncStat[FUNCS_CHUNK_SIZE];
+                stats[funcId / FUNCS_CHUNK_SIZE].storeRelease(chunk);
+            }
+            return &chunk[funcId % FUNCS_CHUNK_SIZE];
+        }
+
+        inline const FuncStat* statIfExists(int funcId) const
+        {
+            const FuncStat *chunk = stats[funcId / FUNCS_CHUNK_SIZE].loadAcquire();
+            return chunk ? &chunk[funcId % FUNCS_CHUNK_SIZE] : 0;
+        }
+    };
+
+    //! NOTE Readers walk threads under read lock (not the owners, they use own data),
+    //! registration and removal of finished threads are under write lock
     struct FuncsData {
-        QMutex mutex;
-        QVector<quintptr> threads;
-        QVector<FuncTimers> timers;
-        QList<QString> staticInfo;
+        mutable QReadWriteLock lock;
+        QList<ThreadData*> threads;
+        QAtomicInt generation;
+        QAtomicInt limitGeneration; //! NOTE Changed by clear and setup, then threads rejected by the limit try again
+
+        FuncsData() : generation(1), limitGeneration(1) {}
+    };
 
-        int threadIndex(quintptr th) const;
-        int addThread(quintptr th);
+    //! NOTE Destroyed on thread exit, marks the data of the thread as finished
+    struct ThreadGuard {
+        bool registered;
+        ~ThreadGuard();
+    };
+
+    ThreadData* threadData();
+    static void threadFinished(ThreadData *td);
+    void resetIfCleared(ThreadData *td) const;
+    PerfCounters* perfCounters(ThreadData *td) const;
+    void addTraceEvent(ThreadData *td, qint64 ns, int id, TraceEventType type) const;
+    static QVector<QString> funcNames();
+    static thread_local ThreadData *s_threadData;
+    static thread_local ThreadGuard s_threadGuard;
+    static thread_local bool s_threadFinished;
+    static thread_local int s_threadRejected;   //! NOTE limitGeneration, when the thread was rejected by the limit
+
+    //! NOTE Immutable, published on setup, so threads read it without lock (not Options, it is replaced by setup)
+    struct LongFuncThresholds {
+        int threadDefault;
+        QHash<QString, int> byThread;   //! NOTE By thread name
+        QHash<int, int> byFunc;         //! NOTE By function id
+        LongFuncThresholds() : threadDefault(0) {}
     };
 
     struct LongFuncDetector {
-        QMutex mutex;
         QThread thread;
         QTimer timer;
         bool enabled;
-        bool needLock;
-        bool locked;
+        int minThreshold;           //! NOTE Of all thresholds, fast check in endFunc
+        QAtomicPointer<const LongFuncThresholds> thresholds;
+        QList<const LongFuncThresholds*> retired; //! NOTE Readers use thresholds without reference, so replaced are deleted with the profiler
 
-        LongFuncDetector() : mutex(QMutex::Recursive), enabled(true), needLock(false), locked(false) {}
+        LongFuncDetector() : enabled(true), minThreshold(0), thresholds(0) {}
+    };
+
+    void publishThresholds(const LongFuncThresholds *thresholds);
 
-        void lockIfNeed(int index);
-        void unlockIfNeed(int index);
+    int longFuncThreshold(const ThreadData *td, int funcId) const;
+    QStringList checkLongFuncs(const ThreadData *td, qint64 now) const;
+
+    //! NOTE Cumulative data, taken by the window thread, windows are deltas between snapshots
+    struct WindowSnapshot {
+        qint64 ns;
+        int generation;
+        Data data;
     };
 
+    struct WindowsData {
+        QMutex mutex;
+        QList<WindowSnapshot> snapshots; //! NOTE The oldest first, windowCount + 1
+    };
+
+    class WindowThread;
+    Data collectData(Data::Mode mode, bool withDetails) const; //! NOTE Details are call tree and percentiles
+    void takeWindowSnapshot();
+    static Data deltaData(const WindowSnapshot &cur, const WindowSnapshot &prev, Data::Mode mode);
+
     static Options m_options;
     Printer *m_printer;
+    CpuSampler *m_sampler;
+    WindowThread *m_windowThread;
+    mutable WindowsData m_windows;
 
     StepsData m_steps;
-    FuncsData m_funcs;
+    mutable FuncsData m_funcs;
     
     mutable LongFuncDetector m_detector;
 };
 
 struct FuncMarker
 {
-    explicit FuncMarker(const QString &fn) : func(fn), th(0)
+    explicit FuncMarker(int id) : funcId(id)
     {
         if (Profiler::m_options.funcsTimeEnabled) {
-            th = reinterpret_cast<quintptr>(QThread::currentThread());
-            Profiler::instance()->beginFunc(func, th);
+            Profiler::instance()->beginFunc(funcId);
         }
     }
 
     ~FuncMarker()
     {
         if (Profiler::m_options.funcsTimeEnabled) {
-            Profiler::instance()->endFunc(func, th);
+            Profiler::instance()->endFunc(funcId);
         }
     }
 
-    const QString &func;
-    quintptr th;
+    const int funcId;
 };
 
 }
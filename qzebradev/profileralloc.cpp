@@ -0,0 +1,149 @@
+#include "profiler.h"
+
+//! NOTE Allocation interposer for Profiler (Options::funcsAllocEnabled), compiled only with QZebraDev_PROFILER_ALLOC.
+//! operator new / delete are replaced on all platforms. With glibc malloc, calloc, realloc and free
+//! are replaced too, they call glibc (__libc_malloc ...), operator new calls it directly, so it is counted once.
+//! The library is static, the object is linked before libc and libstdc++, so it replaces them for the application.
+//! Not replaced: posix_memalign, aligned_alloc, memalign (they are freed by free, it is fine)
+
+#if defined(QZebraDev_PROFILER_ALLOC)
+
+#include <new>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+#define QZebraDev_PROFILER_ALLOC_MALLOC
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+#endif
+
+using namespace QZebraDev;
+
+//! NOTE Profiler::countAlloc is private, only for the interposer
+struct QZebraDev::ProfilerAllocHook {
+    static inline void countAlloc(size_t size) { Profiler::countAlloc(size); }
+};
+
+static inline void *rawMalloc(size_t size)
+{
+#if defined(QZebraDev_PROFILER_ALLOC_MALLOC)
+    return __libc_malloc(size);
+#else
+    return malloc(size);
+#endif
+}
+
+static inline void rawFree(void *ptr)
+{
+#if defined(QZebraDev_PROFILER_ALLOC_MALLOC)
+    __libc_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static void *newAlloc(size_t size)
+{
+    ProfilerAllocHook::countAlloc(size);
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    void *ptr;
+    while ((ptr = rawMalloc(size)) == 0) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+    return ptr;
+}
+
+static void *newAllocNothrow(size_t size)
+{
+    try {
+        return newAlloc(size);
+    } catch (...) {
+        return 0;
+    }
+}
+
+void *operator new(size_t size)
+{
+    return newAlloc(size);
+}
+
+void *operator new[](size_t size)
+{
+    return newAlloc(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return newAllocNothrow(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return newAllocNothrow(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    rawFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    rawFree(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    rawFree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    rawFree(ptr);
+}
+
+#if defined(QZebraDev_PROFILER_ALLOC_MALLOC)
+extern "C" {
+
+void *malloc(size_t size)
+{
+    ProfilerAllocHook::countAlloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    ProfilerAllocHook::countAlloc(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (size > 0) {
+        ProfilerAllocHook::countAlloc(size); //! NOTE As a new allocation, it can be moved
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+}
+#endif
+
+#endif // QZebraDev_PROFILER_ALLOC
@@ -0,0 +1,367 @@
+#include "sharedmemlogdest.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <stdio.h>
+
+#if defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace QZebraDev {
+
+//! NOTE Shared between processes, so only POD, head and tail are on different cache lines
+struct ShmRingHeader {
+    quint32 magic;
+    quint32 version;
+    quint64 capacity;   //! NOTE Power of two
+    qint64 pid;
+    QBasicAtomicInt closed;
+    quint32 reserved;
+    char pad1[32];
+
+    QBasicAtomicInteger<quint64> head;      //! NOTE Written by producer
+    QBasicAtomicInteger<quint64> dropped;
+    char pad2[48];
+
+    QBasicAtomicInteger<quint64> tail;      //! NOTE Written by consumer
+    char pad3[56];
+};
+
+//! NOTE Record: header, payload, aligned by 8
+struct ShmRecordHeader {
+    quint32 size;
+    quint32 flags;
+    qint64 msecs;
+};
+
+}
+
+using namespace QZebraDev;
+
+static const quint32 RING_MAGIC = 0x515A4C52; //! NOTE QZLR
+static const quint32 RING_VERSION = 1;
+static const quint32 RECORD_PAD = 0x1;
+
+static inline quint64 align8(quint64 v)
+{
+    return (v + 7) & ~quint64(7);
+}
+
+const char *SharedMemLogDest::SEGMENT_PREFIX = "/qzebradev-log-";
+
+QString SharedMemLogDest::defaultSegmentName()
+{
+    return QString::fromLatin1(SEGMENT_PREFIX) + QString::number(QCoreApplication::applicationPid());
+}
+
+SharedMemLogDest::SharedMemLogDest(const LogLayout &l, int capacity, const QString &segmentName)
+    : LogDest(l), m_segmentName(segmentName.isEmpty() ? defaultSegmentName() : segmentName),
+      m_header(0), m_data(0), m_mapSize(0)
+{
+#if defined(Q_OS_UNIX)
+    quint64 cap = 4096;
+    while (cap < static_cast<quint64>(capacity)) {
+        cap <<= 1;
+    }
+
+    QByteArray name = QFile::encodeName(m_segmentName);
+    int fd = shm_open(name.constData(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "Debug: SharedMemLogDest can not open %s, errno: %d\n", name.constData(), errno);
+        fflush(stderr);
+        return;
+    }
+
+    size_t size = sizeof(ShmRingHeader) + cap;
+    if (ftruncate(fd, size) == -1) {
+        fprintf(stderr, "Debug: SharedMemLogDest can not resize %s, errno: %d\n", name.constData(), errno);
+        fflush(stderr);
+        ::close(fd);
+        shm_unlink(name.constData());
+        return;
+    }
+
+    void *ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "Debug: SharedMemLogDest can not map %s, errno: %d\n", name.constData(), errno);
+        fflush(stderr);
+        shm_unlink(name.constData());
+        return;
+    }
+
+    m_mapSize = size;
+    m_header = static_cast<ShmRingHeader *>(ptr);
+    m_data = static_cast<char *>(ptr) + sizeof(ShmRingHeader);
+
+    //! NOTE Memory is zeroed by ftruncate
+    m_header->capacity = cap;
+    m_header->pid = QCoreApplication::applicationPid();
+    m_header->version = RING_VERSION;
+    m_header->magic = RING_MAGIC;
+#endif
+}
+
+SharedMemLogDest::~SharedMemLogDest()
+{
+#if defined(Q_OS_UNIX)
+    if (m_header) {
+        m_header->closed.storeRelease(1); //! NOTE The aggregator unlinks the segment after read all
+        munmap(m_header, m_mapSize);
+    }
+#endif
+}
+
+QString SharedMemLogDest::name() const
+{
+    return "SharedMemLogDest";
+}
+
+bool SharedMemLogDest::isValid() const
+{
+    return m_header != 0;
+}
+
+QString SharedMemLogDest::segmentName() const
+{
+    return m_segmentName;
+}
+
+quint64 SharedMemLogDest::droppedCount() const
+{
+    return m_header ? m_header->dropped.load() : 0;
+}
+
+void SharedMemLogDest::write(const LogMsg &logMsg)
+{
+    if (!m_header) {
+        return;
+    }
+
+    QByteArray data = m_layout.output(logMsg).toUtf8();
+
+    const quint64 cap = m_header->capacity;
+    const quint64 total = align8(sizeof(ShmRecordHeader) + data.size());
+    if (total > cap / 2) {
+        m_header->dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    quint64 head = m_header->head.load(); //! NOTE Only producer writes head
+    quint64 tail = m_header->tail.loadAcquire();
+    quint64 pos = head & (cap - 1);
+    quint64 toEnd = cap - pos;
+    quint64 need = (toEnd < total) ? (toEnd + total) : total;
+
+    if (cap - (head - tail) < need) {
+        m_header->dropped.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    if (toEnd < total) { //! NOTE Not enough space until the end, wrap
+        if (toEnd >= sizeof(ShmRecordHeader)) {
+            ShmRecordHeader *pad = reinterpret_cast<ShmRecordHeader *>(m_data + pos);
+            pad->size = 0;
+            pad->flags = RECORD_PAD;
+            pad->msecs = 0;
+        }
+        head += toEnd;
+        pos = 0;
+    }
+
+    ShmRecordHeader *rec = reinterpret_cast<ShmRecordHeader *>(m_data + pos);
+    rec->size = static_cast<quint32>(data.size());
+    rec->flags = 0;
+    rec->msecs = logMsg.msecsSinceEpoch();
+    memcpy(m_data + pos + sizeof(ShmRecordHeader), data.constData(), data.size());
+
+    m_header->head.storeRelease(head + total);
+}
+
+// SharedMemLogReader
+
+SharedMemLogReader::SharedMemLogReader()
+    : m_header(0), m_data(0), m_mapSize(0)
+{
+}
+
+SharedMemLogReader::~SharedMemLogReader()
+{
+    close();
+}
+
+bool SharedMemLogReader::open(const QString &segmentName)
+{
+    close();
+
+#if defined(Q_OS_UNIX)
+    QByteArray name = QFile::encodeName(segmentName);
+    int fd = shm_open(name.constData(), O_RDWR, 0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *ptr = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+
+    ShmRingHeader *header = static_cast<ShmRingHeader *>(ptr);
+    if (header->magic != RING_MAGIC || header->version != RING_VERSION
+            || sizeof(ShmRingHeader) + header->capacity != static_cast<quint64>(st.st_size)) {
+        munmap(ptr, st.st_size);
+        return false;
+    }
+
+    m_segmentName = segmentName;
+    m_mapSize = st.st_size;
+    m_header = header;
+    m_data = static_cast<const char *>(ptr) + sizeof(ShmRingHeader);
+    return true;
+#else
+    Q_UNUSED(segmentName);
+    return false;
+#endif
+}
+
+void SharedMemLogReader::close()
+{
+#if defined(Q_OS_UNIX)
+    if (m_header) {
+        munmap(m_header, m_mapSize);
+    }
+#endif
+    m_header = 0;
+    m_data = 0;
+    m_mapSize = 0;
+}
+
+bool SharedMemLogReader::isOpen() const
+{
+    return m_header != 0;
+}
+
+QString SharedMemLogReader::segmentName() const
+{
+    return m_segmentName;
+}
+
+qint64 SharedMemLogReader::pid() const
+{
+    return m_header ? m_header->pid : 0;
+}
+
+int SharedMemLogReader::read(QList<Record> &records, int maxCount)
+{
+    if (!m_header) {
+        return 0;
+    }
+
+    //! NOTE By the mapped size, the header is shared memory, it is not trusted after open
+    const quint64 cap = m_mapSize - sizeof(ShmRingHeader);
+    quint64 tail = m_header->tail.load(); //! NOTE Only consumer writes tail
+    quint64 head = m_header->head.loadAcquire();
+    if (head < tail || head - tail > cap) {
+        fprintf(stderr, "Debug: SharedMemLogReader corrupted ring %s, skip to head\n", qPrintable(m_segmentName));
+        fflush(stderr);
+        m_header->tail.storeRelease(head);
+        return 0;
+    }
+
+    int count = 0;
+    while (tail < head && (maxCount < 0 || count < maxCount)) {
+        quint64 pos = tail & (cap - 1);
+        quint64 toEnd = cap - pos;
+        if (toEnd < sizeof(ShmRecordHeader)) {
+            tail += toEnd;
+            continue;
+        }
+
+        const ShmRecordHeader *rec = reinterpret_cast<const ShmRecordHeader *>(m_data + pos);
+        if (rec->flags & RECORD_PAD) {
+            tail += toEnd;
+            continue;
+        }
+
+        //! NOTE Records are not wrapped, so the record is before the end of ring and the head
+        quint32 size = rec->size; //! NOTE Read once, it is shared memory
+        quint64 total = align8(sizeof(ShmRecordHeader) + static_cast<quint64>(size));
+        if (total > toEnd || total > head - tail) {
+            fprintf(stderr, "Debug: SharedMemLogReader corrupted record in %s, skip to head\n", qPrintable(m_segmentName));
+            fflush(stderr);
+            tail = head;
+            break;
+        }
+
+        Record r;
+        r.msecs = rec->msecs;
+        r.pid = m_header->pid;
+        r.data = QByteArray(m_data + pos + sizeof(ShmRecordHeader), static_cast<int>(size));
+        records.append(r);
+        ++count;
+
+        tail += total;
+    }
+
+    m_header->tail.storeRelease(tail);
+    return count;
+}
+
+bool SharedMemLogReader::isProducerFinished() const
+{
+    if (!m_header) {
+        return true;
+    }
+
+    if (m_header->closed.loadAcquire()) {
+        return true;
+    }
+
+#if defined(Q_OS_UNIX)
+    if (::kill(static_cast<pid_t>(m_header->pid), 0) == -1 && errno == ESRCH) {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+quint64 SharedMemLogReader::droppedCount() const
+{
+    return m_header ? m_header->dropped.load() : 0;
+}
+
+void SharedMemLogReader::unlink()
+{
+#if defined(Q_OS_UNIX)
+    if (!m_segmentName.isEmpty()) {
+        shm_unlink(QFile::encodeName(m_segmentName).constData());
+    }
+#endif
+}
+
+QStringList SharedMemLogReader::segments()
+{
+    QString prefix = QString::fromLatin1(SharedMemLogDest::SEGMENT_PREFIX).mid(1); //! NOTE Without "/"
+
+    QStringList segments;
+    QDir dir("/dev/shm");
+    foreach (const QString &name, dir.entryList(QStringList() << (prefix + "*"), QDir::Files)) {
+        segments << ("/" + name);
+    }
+    return segments;
+}
@@ -0,0 +1,85 @@
+#ifndef QZebraDev_SHAREDMEMLOGDEST_H
+#define QZebraDev_SHAREDMEMLOGDEST_H
+
+#include "logger.h"
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+
+namespace QZebraDev
+{
+
+struct ShmRingHeader;
+
+/**
+ * @brief Writes records into a lock-free ring in a shared memory segment (POSIX shm)
+ *
+ * One segment per process, named "/qzebradev-log-<pid>" by default.
+ * The ring is single producer (writes are serialized by Logger) and single consumer
+ * (aggregator, see SharedMemLogReader and tools/logaggregator).
+ * If the ring is full the record is dropped and counted.
+ */
+class SharedMemLogDest : public LogDest
+{
+public:
+    SharedMemLogDest(const LogLayout &l, int capacity = 4 * 1024 * 1024, const QString &segmentName = QString());
+    ~SharedMemLogDest();
+
+    QString name() const;
+    void write(const LogMsg &logMsg);
+
+    bool isValid() const;
+    QString segmentName() const;
+    quint64 droppedCount() const;
+
+    static QString defaultSegmentName();
+    static const char *SEGMENT_PREFIX;
+
+private:
+    QString m_segmentName;
+    ShmRingHeader *m_header;
+    char *m_data;
+    size_t m_mapSize;
+};
+
+/**
+ * @brief Reads (drains) records from a segment of SharedMemLogDest
+ */
+class SharedMemLogReader
+{
+public:
+    SharedMemLogReader();
+    ~SharedMemLogReader();
+
+    struct Record {
+        qint64 msecs;
+        qint64 pid;
+        QByteArray data;
+        Record() : msecs(0), pid(0) {}
+    };
+
+    bool open(const QString &segmentName);
+    void close();
+    bool isOpen() const;
+
+    QString segmentName() const;
+    qint64 pid() const;
+
+    int read(QList<Record> &records, int maxCount = -1);
+    bool isProducerFinished() const; //! NOTE Closed or process is dead
+    quint64 droppedCount() const;
+
+    void unlink(); //! NOTE Remove the segment, after the producer is finished and all is read
+
+    static QStringList segments(); //! NOTE Only Linux (lists /dev/shm)
+
+private:
+    QString m_segmentName;
+    ShmRingHeader *m_header;
+    const char *m_data;
+    size_t m_mapSize;
+};
+
+}
+
+#endif // QZebraDev_SHAREDMEMLOGDEST_H
@@ -0,0 +1,264 @@
+#include "socketlogdest.h"
+#include <QDataStream>
+#include <QFile>
+#include <QtEndian>
+#include <stdio.h>
+
+#if defined(Q_OS_UNIX)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace QZebraDev;
+
+static const int FRAME_HEADER_SIZE = 5;
+
+SocketLogDest::SocketLogDest(const QString &socketPath, const LogLayout &l, const Options &opt)
+    : LogDest(l), m_socketPath(socketPath), m_options(opt), m_fd(-1), m_connecting(false),
+      m_batchCount(0), m_framesSize(0), m_sentOffset(0),
+      m_reconnectMs(opt.minReconnectMs), m_dropped(0)
+{
+    m_batch.reserve(m_options.batchSize + 1024);
+    connectSocket();
+}
+
+SocketLogDest::~SocketLogDest()
+{
+    flush();
+    disconnectSocket();
+}
+
+QString SocketLogDest::name() const
+{
+    return "SocketLogDest";
+}
+
+void SocketLogDest::write(const LogMsg &logMsg)
+{
+    if (m_batchCount == 0) {
+        m_batchTimer.start();
+        m_batch.resize(FRAME_HEADER_SIZE); //! NOTE Place for frame header
+    }
+
+    if (m_options.format == Binary) {
+        QDataStream stream(&m_batch, QIODevice::WriteOnly | QIODevice::Append);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << static_cast<qint64>(logMsg.msecsSinceEpoch())
+               << logMsg.type
+               << logMsg.tag
+               << static_cast<quint64>(reinterpret_cast<quintptr>(logMsg.thread))
+               << QByteArray(logMsg.file)
+               << static_cast<qint32>(logMsg.line)
+               << QByteArray(logMsg.func)
+               << logMsg.message;
+    } else {
+        m_batch.append(m_layout.output(logMsg).toUtf8()).append('\n');
+    }
+
+    ++m_batchCount;
+
+    if (m_batch.size() >= m_options.batchSize || m_batchTimer.elapsed() >= m_options.flushIntervalMs) {
+        closeBatch();
+        send();
+    }
+}
+
+void SocketLogDest::flush()
+{
+    closeBatch();
+    send();
+}
+
+void SocketLogDest::closeBatch()
+{
+    if (m_batchCount == 0) {
+        return;
+    }
+
+    quint32 size = static_cast<quint32>(m_batch.size() - FRAME_HEADER_SIZE);
+    qToBigEndian(size, reinterpret_cast<uchar *>(m_batch.data()));
+    m_batch[4] = static_cast<char>(m_options.format);
+
+    Frame frame;
+    frame.data = m_batch;
+    frame.count = m_batchCount;
+    m_frames.append(frame);
+    m_framesSize += frame.data.size();
+
+    m_batch = QByteArray();
+    m_batch.reserve(m_options.batchSize + 1024);
+    m_batchCount = 0;
+
+    //! NOTE Collector is not available too long, drop the oldest (but not partially sent)
+    while (m_framesSize > m_options.maxBufferSize && m_frames.count() > 1) {
+        int index = (m_sentOffset > 0) ? 1 : 0;
+        if (index >= m_frames.count() - 1) {
+            break;
+        }
+        m_framesSize -= m_frames.at(index).data.size();
+        m_dropped += m_frames.at(index).count;
+        m_frames.removeAt(index);
+    }
+}
+
+void SocketLogDest::send()
+{
+    if (m_frames.isEmpty()) {
+        return;
+    }
+
+    if (m_fd == -1) {
+        if (m_reconnectTimer.isValid() && m_reconnectTimer.elapsed() < m_reconnectMs) {
+            return;
+        }
+
+        if (!connectSocket()) {
+            return;
+        }
+    }
+
+    if (m_connecting && !finishConnect()) {
+        return;
+    }
+
+#if defined(Q_OS_UNIX)
+    while (!m_frames.isEmpty()) {
+        const QByteArray &data = m_frames.first().data;
+        ssize_t ret = ::send(m_fd, data.constData() + m_sentOffset, data.size() - m_sentOffset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                disconnectSocket();
+            }
+            return; //! NOTE Socket buffer is full, try with next write or flush
+        }
+
+        m_sentOffset += static_cast<int>(ret);
+        if (m_sentOffset == data.size()) {
+            m_framesSize -= data.size();
+            m_frames.removeFirst();
+            m_sentOffset = 0;
+        }
+    }
+#endif
+}
+
+bool SocketLogDest::connectSocket()
+{
+#if defined(Q_OS_UNIX)
+    QByteArray path = QFile::encodeName(m_socketPath);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= static_cast<int>(sizeof(addr.sun_path))) {
+        fprintf(stderr, "Debug: SocketLogDest socket path is too long %s\n", path.constData());
+        fflush(stderr);
+        return false;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd != -1) {
+        fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+        //! NOTE Before connect, it blocks if the backlog of collector is full
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+
+        int ret;
+        while ((ret = ::connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) == -1 && errno == EINTR) {}
+
+        if (ret == 0) {
+            m_connecting = false;
+            m_reconnectMs = m_options.minReconnectMs;
+            m_reconnectTimer.invalidate();
+            return true;
+        }
+
+        if (errno == EINPROGRESS) {
+            m_connecting = true; //! NOTE Completed in finishConnect
+            return true;
+        }
+
+        //! NOTE EAGAIN - the backlog is full (Linux), tried again after backoff
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+
+    backoff();
+    return false;
+}
+
+bool SocketLogDest::finishConnect()
+{
+#if defined(Q_OS_UNIX)
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 0) <= 0) {
+        return false; //! NOTE Not yet
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        m_connecting = false;
+        backoff();
+        return false;
+    }
+
+    m_connecting = false;
+    m_reconnectMs = m_options.minReconnectMs;
+    m_reconnectTimer.invalidate();
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SocketLogDest::backoff()
+{
+    if (m_reconnectTimer.isValid()) {
+        m_reconnectMs = qMin(m_reconnectMs * 2, m_options.maxReconnectMs);
+    }
+    m_reconnectTimer.start();
+}
+
+void SocketLogDest::disconnectSocket()
+{
+#if defined(Q_OS_UNIX)
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+
+    m_connecting = false;
+    m_sentOffset = 0; //! NOTE Partially sent frame will be sent again on the new connection
+    m_reconnectTimer.start();
+}
+
+bool SocketLogDest::isConnected() const
+{
+    return m_fd != -1 && !m_connecting;
+}
+
+quint64 SocketLogDest::droppedCount() const
+{
+    return m_dropped;
+}
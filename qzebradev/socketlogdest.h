@@ -0,0 +1,90 @@
+#ifndef QZebraDev_SOCKETLOGDEST_H
+#define QZebraDev_SOCKETLOGDEST_H
+
+#include "logger.h"
+#include <QByteArray>
+#include <QList>
+#include <QElapsedTimer>
+
+namespace QZebraDev
+{
+
+/**
+ * @brief Sends records to a local collector over Unix domain socket
+ *
+ * Records are batched into frames, frames are sent without blocking,
+ * while the collector is not available frames are buffered (up to maxBufferSize,
+ * the oldest are dropped) and reconnect is tried with backoff.
+ *
+ * Frame: [quint32 size (big endian)][quint8 format][payload of size bytes]
+ * Text payload:   records formatted by layout, separated by '\n' (utf8)
+ * Binary payload: records serialized by QDataStream (Qt_5_0):
+ *                 qint64 msecsSinceEpoch, QString type, QString tag, quint64 thread,
+ *                 QByteArray file, qint32 line, QByteArray func, QString message
+ */
+class SocketLogDest : public LogDest
+{
+public:
+
+    enum Format {
+        Text    = 0,
+        Binary  = 1
+    };
+
+    struct Options {
+        Format format;
+        int batchSize;          //! NOTE Bytes, frame is closed when batch is full
+        int flushIntervalMs;    //! NOTE Or when batch is older
+        int maxBufferSize;      //! NOTE Bytes of not sent frames
+        int minReconnectMs;
+        int maxReconnectMs;
+
+        Options() : format(Text), batchSize(64 * 1024), flushIntervalMs(100),
+            maxBufferSize(16 * 1024 * 1024), minReconnectMs(100), maxReconnectMs(10000) {}
+    };
+
+    SocketLogDest(const QString &socketPath, const LogLayout &l, const Options &opt = Options());
+    ~SocketLogDest();
+
+    QString name() const;
+    void write(const LogMsg &logMsg);
+    void flush();
+
+    bool isConnected() const;
+    quint64 droppedCount() const; //! NOTE Dropped records because buffer is full
+
+private:
+    void closeBatch();
+    void send();
+    bool connectSocket();
+    bool finishConnect();
+    void disconnectSocket();
+    void backoff();
+
+    QString m_socketPath;
+    Options m_options;
+    int m_fd;
+    bool m_connecting;  //! NOTE Non-blocking connect is in progress
+
+    QByteArray m_batch;
+    int m_batchCount;
+    QElapsedTimer m_batchTimer;
+
+    struct Frame {
+        QByteArray data;
+        int count;
+        Frame() : count(0) {}
+    };
+
+    QList<Frame> m_frames;
+    int m_framesSize;
+    int m_sentOffset;   //! NOTE Sent bytes of the first frame
+
+    QElapsedTimer m_reconnectTimer;
+    int m_reconnectMs;
+    quint64 m_dropped;
+};
+
+}
+
+#endif // QZebraDev_SOCKETLOGDEST_H
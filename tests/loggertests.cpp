@@ -73,6 +73,9 @@ TEST_F(LoggerTests, Example)
     "${thread}"     - thread, the main thread output as "main" otherwise hex
     "${message}"    - message
     "${trimmessage}" - trimmed message
+    "${file}"       - source file (__FILE__)
+    "${line}"       - source line (__LINE__)
+    "${func}"       - source function (Q_FUNC_INFO)
 
     |N - min field width
       */
@@ -84,6 +87,9 @@ TEST_F(LoggerTests, Example)
     //! Catch Qt message
     logger->setIsCatchQtMsg(true);
 
+    //! Level of tag or tag prefix
+    logger->setTagLevel("Network*", Logger::Full);
+
     //! Custom types
     logger->setType("SQLTRACE", true);
 
@@ -201,6 +207,21 @@ TEST_F(LoggerTests, LOG)
     EXPECT_EQ_STR(dest->msgs.at(3).message, "TestBody() Debug msg");
 }
 
+TEST_F(LoggerTests, LOG_SourceLocation)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+    logger->clearDests();
+    LogDestMock *dest = new LogDestMock();
+    logger->addDest(dest);
+
+    LOGI() << "Info msg"; int line = __LINE__;
+    ASSERT_EQ(dest->msgs.count(), 1);
+    EXPECT_STREQ(dest->msgs.at(0).file, __FILE__);
+    EXPECT_EQ(dest->msgs.at(0).line, line);
+    EXPECT_STREQ(dest->msgs.at(0).func, Q_FUNC_INFO);
+}
+
 TEST_F(LoggerTests, QtDebug)
 {
     Logger* logger = Logger::instance();
@@ -266,7 +287,7 @@ TEST_F(LoggerTests, Logger_Dest)
     EXPECT_EQ_STR(dest1Msg.type, "INFO");
     EXPECT_EQ_STR(dest1Msg.tag, "MYTAG");
     EXPECT_EQ_STR(dest1Msg.message, "TestDestMsg");
-    EXPECT_EQ(dest1Msg.dateTime, dt);
+    EXPECT_NEAR(dest1Msg.msecsSinceEpoch(), dt.toMSecsSinceEpoch(), 2);
     EXPECT_EQ(dest1Msg.thread, thread);
 
     ASSERT_EQ(dest2->msgs.count(), 1);
@@ -275,7 +296,7 @@ TEST_F(LoggerTests, Logger_Dest)
     EXPECT_EQ_STR(dest2Msg.type, "INFO");
     EXPECT_EQ_STR(dest2Msg.tag, "MYTAG");
     EXPECT_EQ_STR(dest2Msg.message, "TestDestMsg");
-    EXPECT_EQ(dest2Msg.dateTime, dt);
+    EXPECT_NEAR(dest2Msg.msecsSinceEpoch(), dt.toMSecsSinceEpoch(), 2);
     EXPECT_EQ(dest2Msg.thread, thread);
 }
 
@@ -389,7 +410,7 @@ TEST_F(LoggerTests, Logger_CatchQtMsg)
     EXPECT_EQ_STR(destMsg.type, "DEBUG");
     EXPECT_EQ_STR(destMsg.tag, "Qt");
     EXPECT_EQ_STR(destMsg.message, "TestMsg");
-    EXPECT_EQ(destMsg.dateTime, dt);
+    EXPECT_NEAR(destMsg.msecsSinceEpoch(), dt.toMSecsSinceEpoch(), 2);
     EXPECT_EQ(destMsg.thread, thread);
 
     logger->setIsCatchQtMsg(false);
@@ -399,6 +420,717 @@ TEST_F(LoggerTests, Logger_CatchQtMsg)
     ASSERT_EQ(dest->msgs.count(), 1);
 }
 
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 2, 0))
+#include <QLoggingCategory>
+
+TEST_F(LoggerTests, Logger_QtCategoryFilter)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+
+    LogDestMock *dest = new LogDestMock();
+    logger->clearDests();
+    logger->addDest(dest);
+
+    QLoggingCategory category("qzebradev.tests");
+
+    //! NOTE Category enable bits synced with logger level and types
+    EXPECT_FALSE(category.isDebugEnabled());
+    EXPECT_TRUE(category.isWarningEnabled());
+
+    qCDebug(category) << "Debug msg";
+    ASSERT_EQ(dest->msgs.count(), 0);
+
+    logger->setLevel(Logger::Debug);
+    EXPECT_TRUE(category.isDebugEnabled());
+
+    qCDebug(category) << "Debug msg";
+    ASSERT_EQ(dest->msgs.count(), 1);
+    EXPECT_EQ_STR(dest->msgs.at(0).type, "DEBUG");
+    EXPECT_EQ_STR(dest->msgs.at(0).tag, "Qt");
+
+    logger->setType("DEBUG", false);
+    EXPECT_FALSE(category.isDebugEnabled());
+
+    logger->setLevel(Logger::Off);
+    EXPECT_FALSE(category.isWarningEnabled());
+
+    logger->setupDefault();
+}
+#endif
+
+TEST_F(LoggerTests, Logger_Async)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+
+    LogDestMock *dest = new LogDestMock();
+    logger->clearDests();
+    logger->addDest(dest);
+
+    logger->setIsAsync(true);
+    EXPECT_TRUE(logger->isAsync());
+
+    LOGI() << "Info msg";
+    qWarning() << "Warning msg";
+
+    logger->flush();
+
+    ASSERT_EQ(dest->msgs.count(), 2);
+    EXPECT_EQ_STR(dest->msgs.at(0).type, "INFO");
+    EXPECT_EQ(dest->msgs.at(0).thread, QThread::currentThread());
+    EXPECT_EQ_STR(dest->msgs.at(1).type, "WARN");
+    EXPECT_EQ_STR(dest->msgs.at(1).message, "Warning msg");
+
+    logger->setIsAsync(false);
+    EXPECT_FALSE(logger->isAsync());
+}
+
+TEST_F(LoggerTests, Logger_TagLevel)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+
+    EXPECT_EQ(logger->tagLevel("Network"), Logger::Normal);
+
+    logger->setTagLevel("Network", Logger::Debug);
+    logger->setTagLevel("Db*", Logger::Full);
+    logger->setTagLevel("DbSql*", Logger::Off);
+
+    EXPECT_EQ(logger->tagLevel("Network"), Logger::Debug);
+    EXPECT_EQ(logger->tagLevel("NetworkCache"), Logger::Normal);  //! NOTE Not prefix
+    EXPECT_EQ(logger->tagLevel("DbCache"), Logger::Full);
+    EXPECT_EQ(logger->tagLevel("DbSqlQuery"), Logger::Off);       //! NOTE The longest prefix
+
+    logger->removeTagLevel("Network");
+    EXPECT_EQ(logger->tagLevel("Network"), Logger::Normal);
+
+    logger->setupDefault();
+    EXPECT_EQ(logger->tagLevel("DbCache"), Logger::Normal);
+}
+
+#undef LOG_TAG
+#define LOG_TAG QStringLiteral("Network")
+
+static void logNetworkDebug()
+{
+    LOGD() << "Debug msg"; //! NOTE One call site, level of tag is cached in it
+}
+
+#undef LOG_TAG
+#define LOG_TAG CLASSNAME(Q_FUNC_INFO)
+
+TEST_F(LoggerTests, LOG_TagLevel)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+    logger->clearDests();
+    LogDestMock *dest = new LogDestMock();
+    logger->addDest(dest);
+
+    logNetworkDebug();
+    ASSERT_EQ(dest->msgs.count(), 0); //! NOTE Level Normal
+
+    logger->setTagLevel("Net*", Logger::Debug);
+
+    logNetworkDebug();
+    ASSERT_EQ(dest->msgs.count(), 1);
+    EXPECT_EQ_STR(dest->msgs.at(0).tag, "Network");
+
+    logNetworkDebug();
+    ASSERT_EQ(dest->msgs.count(), 2);
+
+    logger->setLevel(Logger::Debug);
+    logger->setTagLevel("Network", Logger::Off);
+
+    logNetworkDebug();
+    ASSERT_EQ(dest->msgs.count(), 2);
+
+    logger->removeTagLevel("Network");
+
+    logNetworkDebug();
+    ASSERT_EQ(dest->msgs.count(), 3);
+
+    logger->setupDefault();
+}
+
+TEST_F(LoggerTests, LOG_DanglingElse)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+    logger->clearDests();
+    LogDestMock *dest = new LogDestMock();
+    logger->addDest(dest);
+
+    //! NOTE Debug is disabled, the else belongs to the outer if
+    bool elseCalled = false;
+    bool cond = true;
+    if (!cond)
+        LOGI() << "Not called";
+    else
+        LOGD() << "Disabled";
+
+    if (cond)
+        LOGD() << "Disabled";
+    else
+        elseCalled = true;
+
+    EXPECT_FALSE(elseCalled);
+    EXPECT_EQ(dest->msgs.count(), 0);
+
+    logger->setupDefault();
+}
+
+#include <QTemporaryDir>
+#include <QTextStream>
+#include "qzebradev/logconfigwatcher.h"
+
+struct Sleep : public QThread { using QThread::msleep; };
+
+static void writeConfigFile(const QString &filePath, const QString &content)
+{
+    QFile file(filePath + ".tmp");
+    ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+    QFile::remove(filePath);
+    ASSERT_TRUE(QFile::rename(filePath + ".tmp", filePath)); //! NOTE Like editors
+}
+
+TEST_F(LoggerTests, LogConfigWatcher_Apply)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+
+    QTemporaryDir dir;
+    QString filePath = dir.path() + "/log.ini";
+    writeConfigFile(filePath,
+                    "[logger]\n"
+                    "level=Debug\n"
+                    "types=ERROR, WARN, SQLTRACE\n"
+                    "[tags]\n"
+                    "Network*=Full\n"
+                    "[console]\n"
+                    "layout=\"${type} | ${message}\"\n");
+
+    EXPECT_TRUE(LogConfigWatcher::apply(filePath));
+
+    EXPECT_EQ(logger->level(), Logger::Debug);
+    EXPECT_EQ(logger->types().count(), 3);
+    EXPECT_TRUE(logger->isType("SQLTRACE"));
+    EXPECT_EQ(logger->tagLevel("NetworkCache"), Logger::Full);
+
+    ASSERT_EQ(logger->dests().count(), 1);
+    EXPECT_EQ(logger->dests().at(0)->name(), "ConsoleLogDest");
+    EXPECT_EQ_STR(logger->dests().at(0)->layout().format(), "${type} | ${message}");
+
+    EXPECT_FALSE(LogConfigWatcher::apply(dir.path() + "/notexists.ini"));
+
+    logger->setupDefault();
+}
+
+#if defined(Q_OS_LINUX)
+TEST_F(LoggerTests, LogConfigWatcher_Watch)
+{
+    Logger* logger = Logger::instance();
+    logger->setupDefault();
+
+    QTemporaryDir dir;
+    QString filePath = dir.path() + "/log.ini";
+    writeConfigFile(filePath, "[logger]\nlevel=Normal\n");
+
+    LogConfigWatcher watcher(filePath);
+    ASSERT_TRUE(watcher.start());
+    EXPECT_EQ(logger->level(), Logger::Normal);
+
+    writeConfigFile(filePath, "[logger]\nlevel=Full\n[tags]\nMyTag=Debug\n");
+
+    for (int i = 0; i < 200 && logger->level() != Logger::Full; ++i) {
+        Sleep::msleep(10);
+    }
+
+    EXPECT_EQ(logger->level(), Logger::Full);
+    EXPECT_EQ(logger->tagLevel("MyTag"), Logger::Debug);
+
+    watcher.stop();
+    EXPECT_FALSE(watcher.isRunning());
+
+    logger->setupDefault();
+}
+#endif
+
+#if defined(Q_OS_UNIX)
+#include "qzebradev/socketlogdest.h"
+#include <QtEndian>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+
+//! NOTE Simple collector
+struct SocketListener {
+    int fd;
+    int client;
+
+    explicit SocketListener(const QString &path) : fd(-1), client(-1)
+    {
+        QByteArray p = QFile::encodeName(path);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, p.constData(), p.size());
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        ::listen(fd, 4);
+    }
+
+    ~SocketListener()
+    {
+        if (client != -1) { ::close(client); }
+        ::close(fd);
+    }
+
+    static bool waitRead(int sfd)
+    {
+        struct pollfd pfd;
+        pfd.fd = sfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        return ::poll(&pfd, 1, 1000) == 1;
+    }
+
+    bool accept()
+    {
+        if (!waitRead(fd)) { return false; }
+        client = ::accept(fd, 0, 0);
+        return client != -1;
+    }
+
+    bool read(char *buf, int size)
+    {
+        int readed = 0;
+        while (readed < size) {
+            if (!waitRead(client)) { return false; }
+            ssize_t ret = ::recv(client, buf + readed, size - readed, 0);
+            if (ret <= 0) { return false; }
+            readed += static_cast<int>(ret);
+        }
+        return true;
+    }
+
+    QByteArray readFrame(int *format)
+    {
+        char header[5];
+        if (!read(header, 5)) { return QByteArray(); }
+        quint32 size = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header));
+        *format = header[4];
+        QByteArray payload(static_cast<int>(size), '\0');
+        if (!read(payload.data(), payload.size())) { return QByteArray(); }
+        return payload;
+    }
+};
+
+TEST_F(LoggerTests, SocketLogDest_Batch)
+{
+    QTemporaryDir dir;
+    QString path = dir.path() + "/collector.sock";
+    SocketListener listener(path);
+
+    SocketLogDest::Options opt;
+    opt.flushIntervalMs = 100000;
+    SocketLogDest dest(path, LogLayout("${type} | ${message}"), opt);
+    EXPECT_TRUE(dest.isConnected());
+
+    dest.write(LogMsg("INFO", "MyTag", "msg1"));
+    dest.write(LogMsg("WARN", "MyTag", "msg2"));
+    dest.flush(); //! NOTE One frame
+
+    ASSERT_TRUE(listener.accept());
+    int format = -1;
+    QByteArray frame = listener.readFrame(&format);
+    EXPECT_EQ(format, static_cast<int>(SocketLogDest::Text));
+    EXPECT_EQ_STR(QString::fromUtf8(frame), "INFO | msg1\nWARN | msg2\n");
+}
+
+TEST_F(LoggerTests, SocketLogDest_Reconnect)
+{
+    QTemporaryDir dir;
+    QString path = dir.path() + "/collector.sock";
+
+    SocketLogDest::Options opt;
+    opt.minReconnectMs = 0;
+    opt.maxReconnectMs = 0;
+    SocketLogDest dest(path, LogLayout("${message}"), opt);
+    EXPECT_FALSE(dest.isConnected());
+
+    dest.write(LogMsg("INFO", "MyTag", "msg1"));
+    dest.flush(); //! NOTE Buffered, collector is not available
+    EXPECT_FALSE(dest.isConnected());
+
+    SocketListener listener(path);
+    dest.write(LogMsg("INFO", "MyTag", "msg2"));
+    dest.flush();
+    EXPECT_TRUE(dest.isConnected());
+
+    ASSERT_TRUE(listener.accept());
+    int format = -1;
+    EXPECT_EQ_STR(QString::fromUtf8(listener.readFrame(&format)), "msg1\n");
+    EXPECT_EQ_STR(QString::fromUtf8(listener.readFrame(&format)), "msg2\n");
+    EXPECT_EQ(dest.droppedCount(), 0u);
+}
+#endif
+
+#if defined(Q_OS_UNIX)
+#include "qzebradev/sharedmemlogdest.h"
+
+TEST_F(LoggerTests, SharedMemLogDest_Ring)
+{
+    QString segment = SharedMemLogDest::defaultSegmentName() + "-test";
+    SharedMemLogDest *dest = new SharedMemLogDest(LogLayout("${message}"), 4096, segment);
+    ASSERT_TRUE(dest->isValid());
+
+    SharedMemLogReader reader;
+    ASSERT_TRUE(reader.open(segment));
+    EXPECT_EQ(reader.pid(), QCoreApplication::applicationPid());
+
+    //! NOTE Several times over the ring capacity, so it wraps
+    QList<SharedMemLogReader::Record> records;
+    for (int i = 0; i < 500; ++i) {
+        dest->write(LogMsg("INFO", "MyTag", QString("msg%1").arg(i)));
+        if (i % 7 == 0) {
+            reader.read(records);
+        }
+    }
+    reader.read(records);
+
+    ASSERT_EQ(records.count(), 500);
+    EXPECT_EQ(dest->droppedCount(), 0u);
+    for (int i = 0; i < records.count(); ++i) {
+        EXPECT_EQ_STR(QString::fromUtf8(records.at(i).data), QString("msg%1").arg(i));
+    }
+
+    //! NOTE Ring is full, not read
+    for (int i = 0; i < 500; ++i) {
+        dest->write(LogMsg("INFO", "MyTag", QString("msg%1").arg(i)));
+    }
+    EXPECT_GT(dest->droppedCount(), 0u);
+
+    EXPECT_FALSE(reader.isProducerFinished());
+    delete dest;
+    EXPECT_TRUE(reader.isProducerFinished());
+
+    reader.unlink();
+}
+#endif
+
+#if defined(Q_OS_UNIX)
+#include "qzebradev/logmappedfile.h"
+
+TEST_F(LoggerTests, FileLogDest_Mapped)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    FileLogDest::Options opt;
+    opt.mapped = true;
+    opt.mappedChunkSize = 4096;
+    opt.mappedWindowSize = 4096;
+    opt.msyncIntervalMs = 10;
+
+    FileLogDest *dest = new FileLogDest(dir.path(), "myapp", "log", LogLayout("${message}"), opt);
+    QString fileName = dest->fileName();
+    for (int i = 0; i < 1000; ++i) {
+        dest->write(LogMsg("INFO", "MyTag", QString("msg%1").arg(i)));
+    }
+    delete dest;
+
+    QFile file(fileName);
+    ASSERT_TRUE(file.open(QFile::ReadOnly));
+    QList<QByteArray> lines = file.readAll().split('\n');
+    ASSERT_EQ(lines.count(), 1001);
+    EXPECT_TRUE(lines.last().isEmpty()); //! NOTE Preallocated space is truncated
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ_STR(QString::fromUtf8(lines.at(i)), QString("msg%1\r").arg(i));
+    }
+}
+
+struct MappedFileWriter : public QThread {
+    LogMappedFile *file;
+    int num;
+    void run()
+    {
+        for (int i = 0; i < 1000; ++i) {
+            QByteArray data = QString("%1:%2\n").arg(num).arg(i, 4, 10, QChar('0')).toLatin1();
+            file->append(data.constData(), data.size());
+        }
+    }
+};
+
+TEST_F(LoggerTests, LogMappedFile_Threads)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    QString filePath = dir.path() + "/mapped.log";
+
+    LogMappedFile file(4096, 8192, 5);
+    ASSERT_TRUE(file.open(filePath));
+
+    QList<MappedFileWriter *> writers;
+    for (int n = 0; n < 4; ++n) {
+        MappedFileWriter *w = new MappedFileWriter();
+        w->file = &file;
+        w->num = n;
+        writers << w;
+        w->start();
+    }
+
+    foreach (MappedFileWriter *w, writers) {
+        w->wait();
+    }
+    qDeleteAll(writers);
+
+    EXPECT_EQ(file.size(), 4 * 1000 * 7);
+    file.close();
+
+    QFile f(filePath);
+    ASSERT_TRUE(f.open(QFile::ReadOnly));
+    QSet<QByteArray> records;
+    foreach (const QByteArray &line, f.readAll().split('\n')) {
+        if (!line.isEmpty()) {
+            records.insert(line);
+        }
+    }
+
+    EXPECT_EQ(records.count(), 4 * 1000);
+    for (int n = 0; n < 4; ++n) {
+        EXPECT_TRUE(records.contains(QString("%1:%2").arg(n).arg(999, 4, 10, QChar('0')).toLatin1()));
+    }
+
+    //! NOTE Reopen, append to the end
+    ASSERT_TRUE(file.open(filePath));
+    EXPECT_EQ(file.size(), 4 * 1000 * 7);
+}
+#endif
+
+#include <QFileInfo>
+#include <QDir>
+#include "qzebradev/logindex.h"
+
+TEST_F(LoggerTests, FileLogDest_Index)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    FileLogDest::Options opt;
+    opt.indexed = true;
+    opt.indexBlockSize = 256;
+
+    FileLogDest *dest = new FileLogDest(dir.path(), "myapp", "log", LogLayout("${message}"), opt);
+    QString fileName = dest->fileName();
+
+    QDateTime base(QDate::currentDate(), QTime(1, 0));
+    for (int i = 0; i < 1000; ++i) {
+        LogMsg msg((i % 100 == 0) ? "ERROR" : "INFO", "MyTag", QString("msg%1").arg(i));
+        msg.setDateTime(base.addMSecs(i * 1000));
+        dest->write(msg);
+    }
+    delete dest;
+
+    LogIndexReader index;
+    ASSERT_TRUE(index.open(LogIndexWriter::indexPath(fileName)));
+    EXPECT_GT(index.blocks().count(), 10);
+    EXPECT_EQ(index.indexedSize(), QFileInfo(fileName).size());
+
+    QFile file(fileName);
+    ASSERT_TRUE(file.open(QFile::ReadOnly));
+    QByteArray content = file.readAll();
+
+    //! NOTE Found blocks contain all lines of the range and not much more
+    qint64 from = base.addSecs(500).toMSecsSinceEpoch();
+    qint64 to = base.addSecs(510).toMSecsSinceEpoch();
+    QList<LogIndexBlock> blocks = index.find(from, to);
+    ASSERT_FALSE(blocks.isEmpty());
+    EXPECT_LE(blocks.count(), 2);
+
+    QByteArray found;
+    foreach (const LogIndexBlock &b, blocks) {
+        found.append(content.mid(b.offset, b.size));
+    }
+    for (int i = 500; i <= 510; ++i) {
+        EXPECT_TRUE(found.contains(QString("msg%1\r\n").arg(i).toLatin1()));
+    }
+
+    //! NOTE By type
+    QList<LogIndexBlock> errorBlocks = index.find(base.toMSecsSinceEpoch(), base.addDays(1).toMSecsSinceEpoch(),
+                                                  LogIndexWriter::bit("ERROR"));
+    EXPECT_GE(errorBlocks.count(), 10);
+    if (LogIndexWriter::bit("ERROR") != LogIndexWriter::bit("INFO")) {
+        EXPECT_LT(errorBlocks.count(), index.blocks().count());
+    }
+
+    EXPECT_TRUE(index.find(base.addDays(-1).toMSecsSinceEpoch(), base.addSecs(-1).toMSecsSinceEpoch()).isEmpty());
+
+    //! NOTE Bits are persisted, so they are fixed (FNV-1a of UTF-8)
+    EXPECT_EQ(LogIndexWriter::bit("ERROR"), quint32(1) << 17);
+    EXPECT_EQ(LogIndexWriter::bit("INFO"), quint32(1) << 5);
+}
+
+#include "qzebradev/logcodec.h"
+
+TEST_F(LoggerTests, LogCodec_Frame)
+{
+    QByteArray text;
+    for (int i = 0; i < 1000; ++i) {
+        text.append(QString("2017-01-01T10:00:%1.000 | INFO  | MyTag | main | msg%2\r\n").arg(i % 60, 2, 10, QChar('0')).arg(i).toLatin1());
+    }
+
+    QByteArray frame = LogCodec::frame(text.constData(), text.size());
+    EXPECT_TRUE(LogCodec::isFramed(frame.constData(), frame.size()));
+    EXPECT_LT(frame.size(), text.size() / 3);
+
+    QByteArray raw;
+    EXPECT_EQ(LogCodec::readFrame(frame.constData(), frame.size(), 0, raw), frame.size());
+    EXPECT_TRUE(raw == text);
+
+    //! NOTE Not compressible, stored
+    QByteArray noise;
+    for (int i = 0; i < 1000; ++i) {
+        noise.append(static_cast<char>(qHash(i) & 0xFF));
+    }
+    frame = LogCodec::frame(noise.constData(), noise.size());
+    EXPECT_LE(frame.size(), noise.size() + 16);
+    EXPECT_EQ(LogCodec::readFrame(frame.constData(), frame.size(), 0, raw), frame.size());
+    EXPECT_TRUE(raw == noise);
+
+    //! NOTE Truncated
+    EXPECT_EQ(LogCodec::readFrame(frame.constData(), frame.size() - 1, 0, raw), -1);
+}
+
+TEST_F(LoggerTests, FileLogDest_Compressed)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    FileLogDest::Options opt;
+    opt.compressed = true;
+    opt.compressBlockSize = 1024;
+    opt.indexed = true;
+
+    FileLogDest *dest = new FileLogDest(dir.path(), "myapp", "log", LogLayout("${message}"), opt);
+    QString fileName = dest->fileName();
+    for (int i = 0; i < 1000; ++i) {
+        dest->write(LogMsg("INFO", "MyTag", QString("msg%1").arg(i)));
+    }
+    delete dest;
+
+    QFile file(fileName);
+    ASSERT_TRUE(file.open(QFile::ReadOnly));
+    QByteArray content = file.readAll();
+    ASSERT_TRUE(LogCodec::isFramed(content.constData(), content.size()));
+
+    LogIndexReader index;
+    ASSERT_TRUE(index.open(LogIndexWriter::indexPath(fileName)));
+    EXPECT_EQ(index.indexedSize(), content.size());
+
+    //! NOTE Every index block is a frame
+    QByteArray text;
+    QByteArray raw;
+    foreach (const LogIndexBlock &b, index.blocks()) {
+        ASSERT_EQ(LogCodec::readFrame(content.constData(), content.size(), b.offset, raw), b.size);
+        text.append(raw);
+    }
+
+    QList<QByteArray> lines = text.split('\n');
+    ASSERT_EQ(lines.count(), 1001);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ_STR(QString::fromUtf8(lines.at(i)), QString("msg%1\r").arg(i));
+    }
+}
+
+TEST_F(LoggerTests, FileLogDest_CompressedIdle)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    FileLogDest::Options opt;
+    opt.compressed = true;
+    opt.compressBlockSize = 1024;
+    opt.compressFlushIntervalMs = 60000;
+
+    FileLogDest dest(dir.path(), "myapp", "log", LogLayout("${message}"), opt);
+    QFileInfo fi(dest.fileName());
+
+    dest.write(LogMsg("INFO", "MyTag", "msg0"));
+    fi.refresh();
+    EXPECT_EQ(fi.size(), 0);
+
+    //! NOTE Async writer is idle, the block is small and young, so it is kept
+    EXPECT_TRUE(dest.idle(true));
+    fi.refresh();
+    EXPECT_EQ(fi.size(), 0);
+
+    //! NOTE Sync mode, written after each message
+    EXPECT_FALSE(dest.idle(false));
+    fi.refresh();
+    EXPECT_GT(fi.size(), 0);
+    qint64 size = fi.size();
+
+    //! NOTE Quarter of block
+    for (int i = 0; i < 30; ++i) {
+        dest.write(LogMsg("INFO", "MyTag", QString("message%1").arg(i, 3, 10, QChar('0'))));
+    }
+    EXPECT_FALSE(dest.idle(true));
+    fi.refresh();
+    EXPECT_GT(fi.size(), size);
+
+    EXPECT_FALSE(dest.idle(true)); //! NOTE Nothing buffered
+}
+
+TEST_F(LoggerTests, FileLogDest_RotateByWriteTime)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+
+    FileLogDest dest(dir.path(), "myapp", "log", LogLayout("${message}"));
+    QString fileName = dest.fileName();
+
+    //! NOTE Message of the previous day (ex. from the async writer queue) does not switch the file back
+    LogMsg old("INFO", "MyTag", "Yesterday");
+    old.setDateTime(QDateTime::currentDateTime().addDays(-1));
+    dest.write(old);
+    dest.write(LogMsg("INFO", "MyTag", "Today"));
+
+    EXPECT_EQ_STR(dest.fileName(), fileName);
+    EXPECT_EQ(QDir(dir.path()).entryList(QStringList() << "*.log", QDir::Files).count(), 1);
+}
+
+TEST_F(LoggerTests, LogClock_Ticks)
+{
+    qint64 t1 = LogClock::ticks();
+    qint64 t2 = LogClock::ticks();
+    EXPECT_LE(t1, t2);
+
+    EXPECT_NEAR(LogClock::toMSecsSinceEpoch(t2), QDateTime::currentMSecsSinceEpoch(), 2);
+
+    //! NOTE Back conversion gives the same time
+    QDateTime dt(QDate(2016, 11, 4), QTime(12, 2, 32, 345));
+    LogMsg msg("INFO", "MyTag");
+    msg.setDateTime(dt);
+    EXPECT_EQ(msg.dateTime(), dt);
+
+    for (int i = 0; i < 1000; ++i) {
+        QDateTime d = dt.addMSecs(i);
+        EXPECT_EQ(LogClock::toMSecsSinceEpoch(LogClock::fromMSecsSinceEpoch(d.toMSecsSinceEpoch())), d.toMSecsSinceEpoch());
+    }
+
+    //! NOTE No drift, calibration is not changed
+    qint64 before = LogClock::toMSecsSinceEpoch(t1);
+    LogClock::calibrate();
+    EXPECT_NEAR(LogClock::toMSecsSinceEpoch(t1), before, 1);
+}
+
 TEST_F(LoggerTests, LogLayout_FormatTime)
 {
     LogLayout l("");
@@ -468,11 +1200,51 @@ TEST_F(LoggerTests, LogLayout_FormatOutput)
     LogLayout l("${datetime} | ${type|5} | ${tag|26} | ${thread} | ${message}");
 
     LogMsg msg("WARN", "MyTag", "LogLayout_FormatOutput");
-    msg.dateTime = QDateTime(QDate(2016, 11, 4), QTime(12, 2, 32, 345));
+    msg.setDateTime(QDateTime(QDate(2016, 11, 4), QTime(12, 2, 32, 345)));
 
     EXPECT_EQ_STR(l.output(msg), "2016-11-04T12:02:32.345 | WARN  | MyTag                      | main | LogLayout_FormatOutput");
 }
 
+TEST_F(LoggerTests, LogLayout_FormatSourceLocation)
+{
+    LogLayout l("${file}:${line} | ${func|18} | ${message}");
+
+    LogMsg msg("WARN", "MyTag", "src/myclass.cpp", 42, "void My::func()");
+    msg.message = "LogLayout_FormatSourceLocation";
+
+    EXPECT_EQ_STR(l.output(msg), "src/myclass.cpp:42 | void My::func()    | LogLayout_FormatSourceLocation");
+
+    //! NOTE Without location (ex. LogMsg created directly)
+    LogMsg empty("WARN", "MyTag", "Empty");
+    EXPECT_EQ_STR(l.output(empty), ":0 |                    | Empty");
+}
+
+TEST_F(LoggerTests, LogMsg_CopyLocation)
+{
+    //! NOTE Like QML, location strings are temporary
+    QByteArray file("qml/Main.qml");
+    QByteArray func("onClicked");
+
+    LogMsg copy;
+    {
+        LogMsg msg("WARN", "MyTag", file.constData(), 42, func.constData());
+        msg.copyLocation();
+        copy = msg;
+    }
+
+    file.fill('x');
+    func.fill('x');
+
+    EXPECT_STREQ(copy.file, "qml/Main.qml");
+    EXPECT_EQ(copy.line, 42);
+    EXPECT_STREQ(copy.func, "onClicked");
+
+    LogMsg empty("WARN", "MyTag", 0, 0, 0);
+    empty.copyLocation();
+    EXPECT_TRUE(empty.file == 0);
+    EXPECT_TRUE(empty.func == 0);
+}
+
 struct LogLayoutBench : public Overhead::BenchFunc {
 
     LogLayout l;
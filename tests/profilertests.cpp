@@ -2,6 +2,11 @@
 #include "qzebradev/profiler.h"
 #include "qzebradev/profilerlogprinter.h"
 #include "qzebradev/logger.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <thread>
+#include <stdlib.h>
 
 using namespace QZebraDev;
 
@@ -82,13 +87,13 @@ TEST_F(ProfilerTests, Example)
 
     /*
     Main thread. Top 150 by sum time (total count: 2)
-    Function                                                      Call time           Call count          Sum time
-    void Example::func() const                                    0.050 ms            1                   0.050 ms
-    QString Example::func2() const                                0.010 ms            5                   0.050 ms
+    Function                                                      Call time           Call count          Sum time            Self time
+    void Example::func() const                                    0.050 ms            1                   0.050 ms            0.001 ms
+    QString Example::func2() const                                0.010 ms            5                   0.049 ms            0.049 ms
 
 
     Other threads. Top 150 by sum time (total count: 0)
-    Function                                                      Call time           Call count          Sum time
+    Function                                                      Call time           Call count          Sum time            Self time
     */
 
 
@@ -141,6 +146,33 @@ struct PrinterMock : public Profiler::Printer
     };
     Step step;
 
+    void printLongFuncs(const QStringList &funcsStack)
+    {
+        QMutexLocker locker(&mutex); //! NOTE Called from the detector thread
+        longFuncs = funcsStack;
+    }
+
+    QStringList lastLongFuncs()
+    {
+        QMutexLocker locker(&mutex);
+        return longFuncs;
+    }
+
+    void printThreadLongFuncs(const QString &thread, const QStringList &funcsStack)
+    {
+        QMutexLocker locker(&mutex);
+        threadLongFuncs[thread] = funcsStack;
+    }
+
+    QStringList lastThreadLongFuncs(const QString &thread)
+    {
+        QMutexLocker locker(&mutex);
+        return threadLongFuncs.value(thread);
+    }
+
+    QMutex mutex;
+    QStringList longFuncs;
+    QHash<QString, QStringList> threadLongFuncs;
 };
 
 int roundMs(double ms)
@@ -233,12 +265,682 @@ TEST_F(ProfilerTests, Func)
     Profiler::Data::Func func3 = thread.funcs.value("void TestClass::func3()");
     EXPECT_EQ(func3.callcount, 2u);
     EXPECT_EQ(roundMs(func3.sumtimeMs), 300);
+    EXPECT_EQ(roundMs(func3.selftimeMs), 0);
+    EXPECT_EQ(roundMs(func1.selftimeMs), roundMs(func1.sumtimeMs));
 
     Profiler::Data::Func func2 = thread.funcs.value("void TestClass::func2()");
     EXPECT_EQ(func2.callcount, 4u);
     EXPECT_EQ(roundMs(func2.sumtimeMs), 200);
 }
 
+struct HistogramClass {
+    void func(unsigned long ms) {
+        TRACEFUNC;
+        Sleep::msleep(ms);
+    }
+};
+
+TEST_F(ProfilerTests, Func_Histogram)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsHistogramEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    HistogramClass h;
+    for (int i = 0; i < 9; ++i) {
+        h.func(10);
+    }
+    h.func(100);
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    Profiler::Data::Func func = data.threads[data.mainThread].funcs.value("void HistogramClass::func(unsigned long)");
+
+    //! NOTE The mean (19 ms) hides the tail
+    EXPECT_EQ(func.callcount, 10u);
+    EXPECT_NEAR(func.p50Ms, 10, 2);
+    EXPECT_NEAR(func.p90Ms, 10, 2);
+    EXPECT_NEAR(func.p99Ms, 100, 8);
+    EXPECT_NEAR(func.maxMs, 100, 2);
+    EXPECT_LE(func.p99Ms, func.maxMs);
+
+    profiler->setup(Profiler::Options());
+}
+
+TEST_F(ProfilerTests, Func_Sampling)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsSampleRate = 4;
+    opt.funcsHistogramEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    HistogramClass h;
+    for (int i = 0; i < 16; ++i) {
+        h.func(5);
+    }
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    Profiler::Data::Func func = data.threads[data.mainThread].funcs.value("void HistogramClass::func(unsigned long)");
+
+    //! NOTE 4 calls are timed, the count is exact, the sum time is scaled
+    EXPECT_EQ(func.callcount, 16u);
+    EXPECT_NEAR(func.sumtimeMs, 80, 10);
+    EXPECT_NEAR(func.p50Ms, 5, 1);
+
+    profiler->setup(Profiler::Options());
+}
+
+struct RecursiveClass {
+    void func(int depth) {
+        TRACEFUNC;
+        Sleep::msleep(20);
+        if (depth > 1) {
+            func(depth - 1);
+        }
+    }
+};
+
+TEST_F(ProfilerTests, Func_Recursion)
+{
+    Profiler* profiler = Profiler::instance();
+    profiler->clear();
+
+    RecursiveClass r;
+    r.func(3);
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    Profiler::Data::Func func = data.threads[data.mainThread].funcs.value("void RecursiveClass::func(int)");
+
+    //! NOTE All calls are counted, the sum time is of the outermost call
+    EXPECT_EQ(func.callcount, 3u);
+    EXPECT_GE(roundMs(func.sumtimeMs), 60);
+    EXPECT_LT(roundMs(func.sumtimeMs), 80);
+    EXPECT_NEAR(func.selftimeMs, func.sumtimeMs, 1.0);
+}
+
+struct FuncThread : public QThread {
+    int count;
+    FuncThread() : count(0) {}
+    void run()
+    {
+        TestClass t;
+        for (int i = 0; i < count; ++i) {
+            t.func2();
+        }
+    }
+};
+
+TEST_F(ProfilerTests, Func_Threads)
+{
+    Profiler* profiler = Profiler::instance();
+    profiler->clear();
+
+    QList<FuncThread *> threads;
+    for (int i = 0; i < 4; ++i) {
+        FuncThread *th = new FuncThread();
+        th->count = i + 1;
+        threads << th;
+        th->start();
+    }
+
+    foreach (FuncThread *th, threads) {
+        th->wait();
+    }
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyOther);
+    ASSERT_EQ(data.threads.count(), 4);
+
+    uint callcount = 0;
+    foreach (const Profiler::Data::Thread &thread, data.threads) {
+        ASSERT_EQ(thread.funcs.count(), 1);
+        callcount += thread.funcs.value("void TestClass::func2()").callcount;
+    }
+    EXPECT_EQ(callcount, 1u + 2u + 3u + 4u);
+
+    qDeleteAll(threads);
+
+    //! NOTE Data of the threads is not used after clear
+    profiler->clear();
+    data = profiler->threadsData(Profiler::Data::OnlyOther);
+    EXPECT_EQ(data.threads.count(), 0);
+}
+
+static void funcThread(int count)
+{
+    TestClass t;
+    for (int i = 0; i < count; ++i) {
+        t.func2();
+    }
+}
+
+TEST_F(ProfilerTests, Func_ThreadsRecycled)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsMaxThreadCount = 2;
+    profiler->setup(opt);
+    profiler->clear();
+
+    //! NOTE std::thread, join waits for thread locals destructors, so the thread is finished
+    for (int i = 0; i < 3; ++i) {
+        std::thread th(funcThread, i + 1);
+        th.join();
+    }
+
+    //! NOTE Over the limit data of the oldest finished thread is dropped for a new thread, so the last one is profiled
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyOther);
+    bool found = false;
+    foreach (const Profiler::Data::Thread &thread, data.threads) {
+        found = found || thread.funcs.value("void TestClass::func2()").callcount == 3u;
+    }
+    EXPECT_TRUE(found);
+
+    profiler->setup(Profiler::Options());
+}
+
+static int childNode(const Profiler::Data::Thread &thread, int parent, const QString &func)
+{
+    foreach (int c, thread.nodes.at(parent).children) {
+        if (thread.nodes.at(c).func == func) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+TEST_F(ProfilerTests, Func_CallTree)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsCallTreeEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    TestClass t;
+    t.func3();
+    t.func1();
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    Profiler::Data::Thread thread = data.threads[data.mainThread];
+    ASSERT_FALSE(thread.nodes.isEmpty());
+
+    //! NOTE func1 is called from func3 and from the root, these are different nodes
+    int func3 = childNode(thread, 0, "void TestClass::func3()");
+    ASSERT_NE(func3, -1);
+    EXPECT_EQ(thread.nodes.at(func3).callcount, 1u);
+    EXPECT_EQ(roundMs(thread.nodes.at(func3).sumtimeMs), 150);
+    EXPECT_EQ(roundMs(thread.nodes.at(func3).selftimeMs), 0);
+
+    int func31 = childNode(thread, func3, "void TestClass::func1()");
+    ASSERT_NE(func31, -1);
+    EXPECT_EQ(thread.nodes.at(func31).parent, func3);
+    EXPECT_EQ(roundMs(thread.nodes.at(func31).sumtimeMs), 100);
+    EXPECT_NE(childNode(thread, func3, "void TestClass::func2()"), -1);
+
+    int func1 = childNode(thread, 0, "void TestClass::func1()");
+    ASSERT_NE(func1, -1);
+    EXPECT_NE(func1, func31);
+    EXPECT_EQ(thread.nodes.at(func1).callcount, 1u);
+
+    QString callers = profiler->callersString("void TestClass::func1()", Profiler::Data::OnlyMain);
+    EXPECT_TRUE(callers.contains("Callers of void TestClass::func1()"));
+    EXPECT_TRUE(callers.contains("  void TestClass::func3()"));
+
+    QString tree = profiler->callTreeString(Profiler::Data::OnlyMain);
+    EXPECT_TRUE(tree.contains("  void TestClass::func1()"));
+
+    profiler->setup(Profiler::Options());
+}
+
+TEST_F(ProfilerTests, Func_Folded)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsCallTreeEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    TestClass t;
+    t.func3();
+
+    //! NOTE a;b;c <self ns>
+    QHash<QString, qint64> stacks;
+    foreach (const QString &line, profiler->funcsFoldedString(Profiler::Data::OnlyMain).split('\n', QString::SkipEmptyParts)) {
+        stacks.insert(line.section(' ', 0, -2), line.section(' ', -1).toLongLong());
+    }
+
+    EXPECT_EQ(stacks.value("void TestClass::func3();void TestClass::func1()") / 1000000, 100);
+    EXPECT_EQ(stacks.value("void TestClass::func3();void TestClass::func2()") / 1000000, 50);
+    EXPECT_LT(stacks.value("void TestClass::func3()") / 1000000, 1);
+
+    QString perThread = profiler->funcsFoldedString(Profiler::Data::OnlyMain, true);
+    EXPECT_TRUE(perThread.startsWith("main;void TestClass::func3()"));
+
+    //! NOTE ';' in names is replaced, it separates frames
+    profiler->clear();
+    {
+        TRACEFUNC_INFO("info; with semicolon");
+        Sleep::msleep(10);
+    }
+    EXPECT_TRUE(profiler->funcsFoldedString(Profiler::Data::OnlyMain).startsWith("info, with semicolon "));
+
+    profiler->setup(Profiler::Options());
+}
+
+TEST_F(ProfilerTests, Func_Windows)
+{
+    Profiler* profiler = Profiler::instance();
+    profiler->clear();
+
+    //! NOTE The first snapshot is taken on start, before the calls
+    Profiler::Options opt;
+    opt.windowIntervalMs = 100;
+    opt.windowCount = 10;
+    profiler->setup(opt);
+
+    TestClass t;
+    t.func1();
+    t.func1();
+
+    Sleep::msleep(350);
+
+    QString func1 = "void TestClass::func1()";
+
+    //! NOTE All windows
+    Profiler::Data data = profiler->windowData(opt.windowCount, Profiler::Data::OnlyMain);
+    Profiler::Data::Func f = data.threads.value(data.mainThread).funcs.value(func1);
+    EXPECT_EQ(f.callcount, 2u);
+    EXPECT_EQ(roundMs(f.sumtimeMs), 200);
+    EXPECT_GT(f.callsPerSec, 0);
+    EXPECT_GE(roundMs(data.durationMs), 300);
+
+    //! NOTE The last window is after the calls
+    data = profiler->windowData(1, Profiler::Data::OnlyMain);
+    EXPECT_EQ(data.threads.value(data.mainThread).funcs.value(func1).callcount, 0u);
+    EXPECT_GE(roundMs(data.durationMs), 100); //! NOTE No upper bound, the window thread can be late on a loaded machine
+
+    QList<Profiler::Data> history = profiler->windowsHistory(Profiler::Data::OnlyMain);
+    EXPECT_GE(history.count(), 3);
+
+    uint callcount = 0;
+    foreach (const Profiler::Data &w, history) {
+        callcount += w.threads.value(w.mainThread).funcs.value(func1).callcount;
+    }
+    EXPECT_EQ(callcount, 2u);
+
+    EXPECT_TRUE(profiler->windowDataString(opt.windowCount, Profiler::Data::OnlyMain).contains("Calls/s"));
+
+    profiler->setup(Profiler::Options());
+    EXPECT_TRUE(profiler->windowsHistory().isEmpty());
+}
+
+struct AllocClass {
+    //! NOTE Allocated memory is stored to volatile, so allocations are not removed by the compiler
+    static void * volatile sink;
+
+    void outer()
+    {
+        TRACEFUNC;
+        char *p = new char[100];
+        sink = p;
+        delete [] p;
+
+        sink = malloc(100);
+        free(sink);
+
+        inner();
+
+        p = new char[100];
+        sink = p;
+        delete [] p;
+    }
+
+    void inner()
+    {
+        TRACEFUNC;
+        char *p = new char[10];
+        sink = p;
+        delete [] p;
+
+        sink = calloc(10, 100);
+        free(sink);
+    }
+};
+
+void * volatile AllocClass::sink = 0;
+
+TEST_F(ProfilerTests, Func_Alloc)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsAllocEnabled = true;
+    profiler->setup(opt);
+
+    //! NOTE The first call registers names of functions, it allocates
+    AllocClass a;
+    a.outer();
+    profiler->clear();
+
+    a.outer();
+    a.outer();
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    const Profiler::Data::Thread &thread = data.threads.value(data.mainThread);
+
+    //! NOTE Exclusive, allocations of inner are not in outer
+    Profiler::Data::Func outer = thread.funcs.value("void AllocClass::outer()");
+    EXPECT_EQ(outer.allocCount, 6u);
+    EXPECT_EQ(outer.allocBytes, 600u);
+
+    Profiler::Data::Func inner = thread.funcs.value("void AllocClass::inner()");
+    EXPECT_EQ(inner.allocCount, 4u);
+    EXPECT_EQ(inner.allocBytes, 2020u);
+
+    EXPECT_TRUE(profiler->threadsDataString(Profiler::Data::OnlyMain).contains("Alloc bytes"));
+
+    //! NOTE Disabled
+    profiler->setup(Profiler::Options());
+    profiler->clear();
+    a.outer();
+    data = profiler->threadsData(Profiler::Data::OnlyMain);
+    EXPECT_EQ(data.threads.value(data.mainThread).funcs.value("void AllocClass::outer()").allocCount, 0u);
+}
+
+static QList<QJsonObject> traceEvents(const QByteArray &json, const QString &ph)
+{
+    QList<QJsonObject> events;
+    foreach (const QJsonValue &v, QJsonDocument::fromJson(json).object().value("traceEvents").toArray()) {
+        if (v.toObject().value("ph").toString() == ph) {
+            events << v.toObject();
+        }
+    }
+    return events;
+}
+
+TEST_F(ProfilerTests, Func_TraceCapture)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.traceCaptureEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    TestClass t;
+    t.func3();
+    profiler->stepTime("Trace", "after func3");
+
+    QByteArray json = profiler->traceJson();
+    ASSERT_FALSE(QJsonDocument::fromJson(json).isNull());
+
+    //! NOTE Complete events are written on the end of function, callees first
+    QList<QJsonObject> spans = traceEvents(json, "X");
+    ASSERT_EQ(spans.count(), 3);
+    EXPECT_EQ_STR(spans.at(0).value("name").toString(), "void TestClass::func1()");
+    EXPECT_EQ_STR(spans.at(1).value("name").toString(), "void TestClass::func2()");
+    EXPECT_EQ_STR(spans.at(2).value("name").toString(), "void TestClass::func3()");
+    EXPECT_EQ(qRound(spans.at(0).value("dur").toDouble() / 1000), 100);
+    EXPECT_GE(spans.at(1).value("ts").toDouble(), spans.at(0).value("ts").toDouble() + spans.at(0).value("dur").toDouble());
+    EXPECT_GE(spans.at(2).value("dur").toDouble(), spans.at(0).value("dur").toDouble() + spans.at(1).value("dur").toDouble());
+
+    QList<QJsonObject> steps = traceEvents(json, "i");
+    ASSERT_EQ(steps.count(), 1);
+    EXPECT_EQ_STR(steps.at(0).value("name").toString(), "Trace: after func3");
+
+    //! NOTE Ring buffer keeps the last events
+    opt.traceBufferSize = 4;
+    profiler->setup(opt);
+    profiler->clear();
+
+    struct TraceThread : public QThread {
+        void run()
+        {
+            Example example;
+            for (int i = 0; i < 5; ++i) {
+                example.func2();
+            }
+        }
+    };
+
+    TraceThread thread; //! NOTE New thread, the buffer is allocated with the new size
+    thread.setObjectName("TraceThread");
+    thread.start();
+    thread.wait();
+
+    json = profiler->traceJson();
+    EXPECT_EQ(traceEvents(json, "X").count(), 2);
+
+    //! NOTE Threads are named by object name
+    bool named = false;
+    foreach (const QJsonObject &m, traceEvents(json, "M")) {
+        named = named || m.value("args").toObject().value("name").toString() == "TraceThread";
+    }
+    EXPECT_TRUE(named);
+
+    //! NOTE Texts of steps are a ring of the same size, overwritten are without text
+    for (int i = 0; i < 6; ++i) {
+        profiler->stepTime("Trace", QString("step %1").arg(i));
+    }
+
+    steps = traceEvents(profiler->traceJson(), "i");
+    ASSERT_EQ(steps.count(), 6);
+    EXPECT_EQ_STR(steps.at(0).value("name").toString(), "step");
+    EXPECT_EQ_STR(steps.at(2).value("name").toString(), "Trace: step 2");
+    EXPECT_EQ_STR(steps.at(5).value("name").toString(), "Trace: step 5");
+
+    profiler->setup(Profiler::Options());
+}
+
+TEST_F(ProfilerTests, LongFuncDetector)
+{
+    PrinterMock *printer = new PrinterMock();
+    Profiler::Options opt;
+    opt.longFuncThreshold = 100;
+    Profiler::instance()->setup(opt, printer);
+
+    //! NOTE The stack of the main thread is read without blocking it
+    Example example;
+    example.veryLongFunc();
+
+    QStringList funcs = printer->lastLongFuncs();
+    ASSERT_GE(funcs.count(), 2);
+    EXPECT_TRUE(funcs.at(0).startsWith("void Example::veryLongFunc()"));
+    EXPECT_TRUE(funcs.at(1).startsWith("void Example::stackFunc()"));
+
+    Profiler::instance()->setup(Profiler::Options());
+}
+
+TEST_F(ProfilerTests, LongFuncDetector_Sampling)
+{
+    PrinterMock *printer = new PrinterMock();
+    Profiler::Options opt;
+    opt.longFuncThreshold = 100;
+    opt.funcsSampleRate = 1000;
+    Profiler::instance()->setup(opt, printer);
+
+    //! NOTE The first call is sampled, the second is not, but it is detected too
+    Example example;
+    example.longFunc(1);
+    example.longFunc(300);
+
+    QStringList funcs = printer->lastLongFuncs();
+    ASSERT_GE(funcs.count(), 1);
+    EXPECT_TRUE(funcs.at(0).startsWith("void Example::longFunc(unsigned long) const"));
+
+    Profiler::instance()->setup(Profiler::Options());
+}
+
+struct StallThread : public QThread {
+    void run()
+    {
+        HistogramClass h;
+        h.func(400);
+    }
+};
+
+TEST_F(ProfilerTests, LongFuncDetector_Threads)
+{
+    PrinterMock *printer = new PrinterMock();
+    Profiler::Options opt;
+    opt.longFuncDetectorAllThreads = true;
+    opt.longFuncThreadThresholds["StallThread"] = 100;
+    opt.longFuncFuncThresholds["void TestClass::func1()"] = 50;
+    Profiler::instance()->setup(opt, printer);
+
+    //! NOTE Threshold of the thread
+    StallThread thread;
+    thread.setObjectName("StallThread");
+    thread.start();
+    thread.wait();
+
+    QStringList funcs = printer->lastThreadLongFuncs("StallThread");
+    ASSERT_EQ(funcs.count(), 1);
+    EXPECT_TRUE(funcs.at(0).startsWith("void HistogramClass::func(unsigned long)"));
+
+    //! NOTE Threshold of the function, the main thread has the default threshold
+    TestClass t;
+    t.func1();
+    t.func1();
+
+    funcs = printer->lastLongFuncs();
+    ASSERT_EQ(funcs.count(), 1);
+    EXPECT_TRUE(funcs.at(0).startsWith("void TestClass::func1()"));
+
+    Profiler::instance()->setup(Profiler::Options());
+}
+
+#if defined(Q_OS_LINUX)
+TEST_F(ProfilerTests, LongFuncDetector_NativeStack)
+{
+    PrinterMock *printer = new PrinterMock();
+    Profiler::Options opt;
+    opt.longFuncDetectorAllThreads = true;
+    opt.longFuncNativeStack = true;
+    opt.longFuncThreadThresholds["StallThread"] = 100;
+    Profiler::instance()->setup(opt, printer);
+
+    StallThread thread;
+    thread.setObjectName("StallThread");
+    thread.start();
+    thread.wait();
+
+    //! NOTE The thread is stuck in sleep, it is not instrumented
+    QStringList funcs = printer->lastThreadLongFuncs("StallThread");
+    ASSERT_GE(funcs.count(), 3);
+    EXPECT_TRUE(funcs.at(0).startsWith("void HistogramClass::func(unsigned long)"));
+    EXPECT_EQ_STR(funcs.at(1), "Native stack:");
+    EXPECT_TRUE(funcs.join("\n").contains("sleep"));
+
+    Profiler::instance()->setup(Profiler::Options());
+}
+#endif
+
+#if defined(Q_OS_LINUX)
+static double burnCpu(int ms)
+{
+    volatile double x = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms) {
+        for (int i = 0; i < 10000; ++i) {
+            x += i * 0.5;
+        }
+    }
+    return x;
+}
+
+TEST_F(ProfilerTests, CpuSampling)
+{
+    Profiler* profiler = Profiler::instance();
+    ASSERT_TRUE(profiler->startSampling(1000));
+    EXPECT_TRUE(profiler->isSampling());
+
+    burnCpu(300);
+
+    profiler->stopSampling();
+    EXPECT_FALSE(profiler->isSampling());
+
+    //! NOTE About 300 samples of the main thread, not exact (scheduling, timer resolution)
+    QHash<QString, quint64> stacks = profiler->sampledStacks(false);
+    quint64 total = 0;
+    foreach (quint64 count, stacks) {
+        total += count;
+    }
+    EXPECT_GT(total, 100u);
+
+    QString folded = profiler->sampledFoldedString();
+    QStringList lines = folded.split('\n', QString::SkipEmptyParts);
+    ASSERT_FALSE(lines.isEmpty());
+    EXPECT_TRUE(lines.first().contains(';'));
+    EXPECT_GT(lines.first().section(' ', -1).toInt(), 0);
+
+    EXPECT_TRUE(profiler->sampledTopString(10).contains("by self samples"));
+}
+
+struct PerfClass {
+    void busy()
+    {
+        TRACEFUNC;
+        burnCpu(100);
+    }
+
+    void sleep()
+    {
+        TRACEFUNC;
+        Sleep::msleep(100);
+    }
+};
+
+TEST_F(ProfilerTests, Func_PerfCounters)
+{
+    Profiler* profiler = Profiler::instance();
+    Profiler::Options opt;
+    opt.funcsPerfCountersEnabled = true;
+    profiler->setup(opt);
+    profiler->clear();
+
+    PerfClass p;
+    p.busy();
+    p.sleep();
+
+    Profiler::Data data = profiler->threadsData(Profiler::Data::OnlyMain);
+    const Profiler::Data::Thread &thread = data.threads.value(data.mainThread);
+    Profiler::Data::Func busy = thread.funcs.value("void PerfClass::busy()");
+    Profiler::Data::Func sleep = thread.funcs.value("void PerfClass::sleep()");
+
+    //! NOTE CPU time and context switches are available without PMU access (software counters)
+    EXPECT_GT(roundMs(busy.cpuTimeMs), 50);
+    EXPECT_LT(roundMs(sleep.cpuTimeMs), 50);
+    EXPECT_GE(sleep.contextSwitches, 1.0);
+
+    PerfCounters perf;
+    if (perf.open() && perf.isHardware()) {
+        EXPECT_GT(busy.instructions, 0.0);
+        EXPECT_GT(busy.cycles, 0.0);
+    } else {
+        EXPECT_EQ(busy.cycles, 0.0);
+    }
+
+    EXPECT_TRUE(profiler->threadsDataString(Profiler::Data::OnlyMain).contains("IPC"));
+
+    profiler->setup(Profiler::Options());
+}
+#endif
+
+TEST_F(ProfilerTests, FuncId)
+{
+    int id1 = Profiler::funcId("void FuncIdTest::func1()");
+    int id2 = Profiler::funcId("void FuncIdTest::func2()");
+
+    EXPECT_GE(id1, 0);
+    EXPECT_EQ(id2, id1 + 1);
+    EXPECT_EQ(Profiler::funcId("void FuncIdTest::func1()"), id1);
+    EXPECT_EQ_STR(Profiler::funcName(id2), "void FuncIdTest::func2()");
+    EXPECT_GT(Profiler::funcsCount(), id2);
+}
+
 TEST_F(ProfilerTests, DISABLED_Overhead)
 {
     struct Funcs : public Overhead::OverFuncs {
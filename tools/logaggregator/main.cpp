@@ -0,0 +1,141 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <QHash>
+#include <QFile>
+#include <QDateTime>
+#include <QThread>
+#include <stdio.h>
+#include <algorithm>
+
+#include "qzebradev/sharedmemlogdest.h"
+
+using namespace QZebraDev;
+
+/**
+ * Drains rings of SharedMemLogDest of all processes on the host
+ * and writes one stream ordered by timestamp.
+ *
+ * logaggregator [-o file] [--holdback ms] [--interval ms] [--pid] [--once]
+ *
+ * -o           output file (default stdout)
+ * --holdback   records are held this time to be ordered with other processes (default 500 ms)
+ * --interval   poll interval (default 50 ms)
+ * --pid        prefix records with the process id
+ * --once       drain all and exit
+ */
+
+struct Sleep : public QThread { using QThread::msleep; };
+
+struct IsLessByTime {
+    bool operator()(const SharedMemLogReader::Record &f, const SharedMemLogReader::Record &s) const
+    {
+        return f.msecs < s.msecs;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QString outPath;
+    int holdbackMs = 500;
+    int intervalMs = 50;
+    bool withPid = false;
+    bool once = false;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.count(); ++i) {
+        const QString &a = args.at(i);
+        if (a == "-o" && i + 1 < args.count()) {
+            outPath = args.at(++i);
+        } else if (a == "--holdback" && i + 1 < args.count()) {
+            holdbackMs = args.at(++i).toInt();
+        } else if (a == "--interval" && i + 1 < args.count()) {
+            intervalMs = args.at(++i).toInt();
+        } else if (a == "--pid") {
+            withPid = true;
+        } else if (a == "--once") {
+            once = true;
+        } else {
+            fprintf(stderr, "Usage: logaggregator [-o file] [--holdback ms] [--interval ms] [--pid] [--once]\n");
+            return 1;
+        }
+    }
+
+    QFile out;
+    bool opened = false;
+    if (outPath.isEmpty()) {
+        opened = out.open(stdout, QFile::WriteOnly);
+    } else {
+        out.setFileName(outPath);
+        opened = out.open(QFile::Append);
+    }
+
+    if (!opened) {
+        fprintf(stderr, "logaggregator: can not open output %s\n", qPrintable(outPath));
+        return 1;
+    }
+
+    QHash<QString, SharedMemLogReader *> readers;
+    QList<SharedMemLogReader::Record> pending;
+
+    forever {
+
+        foreach (const QString &segment, SharedMemLogReader::segments()) {
+            if (!readers.contains(segment)) {
+                SharedMemLogReader *reader = new SharedMemLogReader();
+                if (reader->open(segment)) {
+                    readers.insert(segment, reader);
+                } else {
+                    delete reader;
+                }
+            }
+        }
+
+        QHash<QString, SharedMemLogReader *>::Iterator it = readers.begin();
+        while (it != readers.end()) {
+            SharedMemLogReader *reader = it.value();
+            bool finished = reader->isProducerFinished(); //! NOTE Before read, so nothing is lost
+            reader->read(pending);
+            if (finished) {
+                if (reader->droppedCount() > 0) {
+                    fprintf(stderr, "logaggregator: %s dropped %llu records\n", qPrintable(reader->segmentName()),
+                            static_cast<unsigned long long>(reader->droppedCount()));
+                }
+                reader->unlink();
+                delete reader;
+                it = readers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        std::stable_sort(pending.begin(), pending.end(), IsLessByTime());
+
+        qint64 border = once ? Q_INT64_C(0x7FFFFFFFFFFFFFFF) : QDateTime::currentMSecsSinceEpoch() - holdbackMs;
+        int count = 0;
+        for (; count < pending.count() && pending.at(count).msecs <= border; ++count) {
+            const SharedMemLogReader::Record &r = pending.at(count);
+            if (withPid) {
+                out.write(QByteArray::number(r.pid));
+                out.write(" | ");
+            }
+            out.write(r.data);
+            out.write("\n");
+        }
+
+        if (count > 0) {
+            pending.erase(pending.begin(), pending.begin() + count);
+            out.flush();
+        }
+
+        if (once) {
+            break;
+        }
+
+        Sleep::msleep(intervalMs);
+    }
+
+    qDeleteAll(readers);
+    return 0;
+}
@@ -0,0 +1,338 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <QSet>
+#include <QFile>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QRegExp>
+#include <stdio.h>
+#include <string.h>
+
+#include "qzebradev/logger.h"
+#include "qzebradev/logindex.h"
+#include "qzebradev/logcodec.h"
+
+using namespace QZebraDev;
+
+/**
+ * Returns lines of a log file (FileLogDest) by time range, types and tags.
+ * If there is companion index (<file>.idx, FileLogDest::Options::indexed),
+ * only the blocks found by the index are scanned, else the whole file.
+ * Compressed files (FileLogDest::Options::compressed) are decompressed by frames on the fly.
+ *
+ * logquery <file> [--from time] [--to time] [--date date] [--type type]... [--tag tag]... [--layout format] [--cat]
+ *
+ * --from, --to   yyyy-MM-ddThh:mm:ss[.zzz] or hh:mm[:ss[.zzz]] (date of the log)
+ * --date         yyyy-MM-dd, date of the log for times without date, by default from the index,
+ *                else from the file name (<name>-yyMMdd.<ext>), else from the first line (${datetime})
+ * --type         message type, can be several
+ * --tag          message tag, can be several
+ * --layout       layout of the file (default "${datetime} | ${type|5} | ${tag|26} | ${thread} | ${message}")
+ * --cat          print all lines (decompressed), for example: logquery file.log --cat | less
+ */
+
+static const QString DEFAULT_LAYOUT("${datetime} | ${type|5} | ${tag|26} | ${thread} | ${message}");
+
+struct Line {
+    qint64 msecs;
+    QString type;
+    QString tag;
+    Line() : msecs(-1) {}
+};
+
+//! NOTE Splits line by literal parts of the layout
+class LineParser
+{
+public:
+    explicit LineParser(const QString &format)
+        : m_patterns(LogLayout::patterns(format)) {}
+
+    bool parse(const QString &str, const QDate &date, Line &line) const
+    {
+        int pos = 0;
+        for (int i = 0; i < m_patterns.count(); ++i) {
+            const LogLayout::Pattern &p = m_patterns.at(i);
+            if (!str.midRef(pos).startsWith(p.beforeStr)) {
+                return false;
+            }
+            pos += p.beforeStr.length();
+
+            int end = str.length();
+            if (i + 1 < m_patterns.count() && !m_patterns.at(i + 1).beforeStr.isEmpty()) {
+                end = str.indexOf(m_patterns.at(i + 1).beforeStr, pos);
+                if (end == -1) {
+                    return false;
+                }
+            }
+
+            QString val = str.mid(pos, end - pos).trimmed();
+            pos = end;
+
+            if (p.pattern == "${datetime}") {
+                line.msecs = QDateTime::fromString(val, "yyyy-MM-ddThh:mm:ss.zzz").toMSecsSinceEpoch();
+            } else if (p.pattern == "${time}") {
+                line.msecs = QDateTime(date, QTime::fromString(val, "hh:mm:ss.zzz")).toMSecsSinceEpoch();
+            } else if (p.pattern == "${type}") {
+                line.type = val;
+            } else if (p.pattern == "${tag}") {
+                line.tag = val;
+            }
+        }
+        return true;
+    }
+
+private:
+    QList<LogLayout::Pattern> m_patterns;
+};
+
+static qint64 parseTime(const QString &str, const QDate &date, bool isEnd)
+{
+    QDateTime dt = QDateTime::fromString(str, Qt::ISODate);
+    if (dt.isValid()) {
+        return dt.toMSecsSinceEpoch();
+    }
+
+    static const char *formats[] = { "hh:mm:ss.zzz", "hh:mm:ss", "hh:mm" };
+    for (int i = 0; i < 3; ++i) {
+        QTime t = QTime::fromString(str, formats[i]);
+        if (t.isValid()) {
+            qint64 msecs = QDateTime(date, t).toMSecsSinceEpoch();
+            if (isEnd) { //! NOTE Till the end of the given second or minute
+                msecs += (i == 1) ? 999 : (i == 2) ? 59999 : 0;
+            }
+            return msecs;
+        }
+    }
+
+    return -1;
+}
+
+//! NOTE Date of the log file, see --date
+static QDate logDate(const QString &filePath, const LogIndexReader &index, const uchar *data, qint64 size, bool framed,
+                     const QString &layout)
+{
+    if (!index.blocks().isEmpty()) {
+        return QDateTime::fromMSecsSinceEpoch(index.blocks().first().minMsecs).date();
+    }
+
+    //! NOTE FileLogDest rotates daily, <name>-yyMMdd.<ext>
+    QRegExp nameDate("-(\\d{6})\\.[^.]*$");
+    if (nameDate.indexIn(QFileInfo(filePath).fileName()) != -1) {
+        QDate date = QDate::fromString(nameDate.cap(1), "yyMMdd");
+        if (date.isValid()) {
+            return date.addYears(100); //! NOTE yy is 19yy
+        }
+    }
+
+    if (!framed && size > 0 && layout.contains("${datetime")) {
+        LineParser parser(layout);
+        const uchar *nl = static_cast<const uchar *>(memchr(data, '\n', size));
+        qint64 len = nl ? nl - data : size;
+        Line line;
+        if (parser.parse(QString::fromUtf8(reinterpret_cast<const char *>(data), len).trimmed(), QDate(), line) && line.msecs > 0) {
+            return QDateTime::fromMSecsSinceEpoch(line.msecs).date();
+        }
+    }
+
+    return QDate();
+}
+
+static bool isTimeOnly(const QString &str)
+{
+    return !str.isEmpty() && !QDateTime::fromString(str, Qt::ISODate).isValid();
+}
+
+struct Query {
+    qint64 fromMsecs;
+    qint64 toMsecs;
+    QSet<QString> types;
+    QSet<QString> tags;
+    bool all;
+    Query() : fromMsecs(Q_INT64_C(-0x7FFFFFFFFFFFFFFF)), toMsecs(Q_INT64_C(0x7FFFFFFFFFFFFFFF)), all(false) {}
+
+    bool isMatch(const Line &l) const
+    {
+        if (l.msecs < fromMsecs || l.msecs > toMsecs) {
+            return false;
+        }
+
+        if (!types.isEmpty() && !types.contains(l.type)) {
+            return false;
+        }
+
+        if (!tags.isEmpty() && !tags.contains(l.tag)) {
+            return false;
+        }
+
+        return true;
+    }
+};
+
+static int scan(const uchar *data, qint64 begin, qint64 end, const LineParser &parser, const QDate &date,
+                const Query &query, QFile &out)
+{
+    int count = 0;
+    qint64 pos = begin;
+    while (pos < end) {
+        const uchar *nl = static_cast<const uchar *>(memchr(data + pos, '\n', end - pos));
+        qint64 lineEnd = nl ? (nl - data) : end;
+
+        qint64 len = lineEnd - pos;
+        if (len > 0 && data[pos + len - 1] == '\r') {
+            --len;
+        }
+
+        QString str = query.all ? QString() : QString::fromUtf8(reinterpret_cast<const char *>(data + pos), len);
+        Line line;
+        if (query.all || (parser.parse(str, date, line) && query.isMatch(line))) {
+            out.write(reinterpret_cast<const char *>(data + pos), len);
+            out.write("\n");
+            ++count;
+        }
+
+        pos = lineEnd + 1;
+    }
+    return count;
+}
+
+static int scanFrames(const uchar *data, qint64 begin, qint64 end, const LineParser &parser, const QDate &date,
+                      const Query &query, QFile &out)
+{
+    int count = 0;
+    QByteArray raw;
+    qint64 pos = begin;
+    while (pos < end) {
+        qint64 size = LogCodec::readFrame(reinterpret_cast<const char *>(data), end, pos, raw);
+        if (size == -1) {
+            fprintf(stderr, "logquery: corrupted frame at %lld\n", static_cast<long long>(pos));
+            break;
+        }
+
+        count += scan(reinterpret_cast<const uchar *>(raw.constData()), 0, raw.size(), parser, date, query, out);
+        pos += size;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QString filePath;
+    QString fromStr;
+    QString toStr;
+    QString layout = DEFAULT_LAYOUT;
+    QDate date;
+    Query query;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.count(); ++i) {
+        const QString &a = args.at(i);
+        if (a == "--from" && i + 1 < args.count()) {
+            fromStr = args.at(++i);
+        } else if (a == "--to" && i + 1 < args.count()) {
+            toStr = args.at(++i);
+        } else if (a == "--date" && i + 1 < args.count()) {
+            date = QDate::fromString(args.at(++i), Qt::ISODate);
+            if (!date.isValid()) {
+                fprintf(stderr, "logquery: bad date %s\n", qPrintable(args.at(i)));
+                return 1;
+            }
+        } else if (a == "--type" && i + 1 < args.count()) {
+            query.types << args.at(++i);
+        } else if (a == "--tag" && i + 1 < args.count()) {
+            query.tags << args.at(++i);
+        } else if (a == "--layout" && i + 1 < args.count()) {
+            layout = args.at(++i);
+        } else if (a == "--cat") {
+            query.all = true;
+        } else if (!a.startsWith("--") && filePath.isEmpty()) {
+            filePath = a;
+        } else {
+            filePath.clear();
+            break;
+        }
+    }
+
+    if (filePath.isEmpty()) {
+        fprintf(stderr, "Usage: logquery <file> [--from time] [--to time] [--date date] [--type type]... [--tag tag]... [--layout format] [--cat]\n");
+        return 1;
+    }
+
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly)) {
+        fprintf(stderr, "logquery: can not open %s\n", qPrintable(filePath));
+        return 1;
+    }
+
+    const qint64 fileSize = file.size();
+    const uchar *data = fileSize > 0 ? file.map(0, fileSize) : 0;
+    if (fileSize > 0 && !data) {
+        fprintf(stderr, "logquery: can not map %s\n", qPrintable(filePath));
+        return 1;
+    }
+
+    const bool framed = LogCodec::isFramed(reinterpret_cast<const char *>(data), fileSize);
+    int (*scanRange)(const uchar *, qint64, qint64, const LineParser &, const QDate &, const Query &, QFile &)
+            = framed ? scanFrames : scan;
+
+    LogIndexReader index;
+    bool hasIndex = !query.all && index.open(LogIndexWriter::indexPath(filePath));
+
+    //! NOTE For times without date, the file is rotated daily
+    bool needDate = isTimeOnly(fromStr) || isTimeOnly(toStr) || (!query.all && layout.contains("${time"));
+    if (needDate && !date.isValid()) {
+        date = logDate(filePath, index, data, fileSize, framed, layout);
+        if (!date.isValid()) {
+            fprintf(stderr, "logquery: can not get date of %s, use --date or times with date\n", qPrintable(filePath));
+            return 1;
+        }
+    }
+
+    if (!fromStr.isEmpty() && (query.fromMsecs = parseTime(fromStr, date, false)) == -1) {
+        fprintf(stderr, "logquery: bad time %s\n", qPrintable(fromStr));
+        return 1;
+    }
+
+    if (!toStr.isEmpty() && (query.toMsecs = parseTime(toStr, date, true)) == -1) {
+        fprintf(stderr, "logquery: bad time %s\n", qPrintable(toStr));
+        return 1;
+    }
+
+    QFile out;
+    out.open(stdout, QFile::WriteOnly);
+
+    LineParser parser(layout);
+
+    qint64 scanFrom = 0;
+    if (hasIndex) {
+        quint32 types = 0;
+        foreach (const QString &t, query.types) {
+            types |= LogIndexWriter::bit(t);
+        }
+
+        quint32 tags = 0;
+        foreach (const QString &t, query.tags) {
+            tags |= LogIndexWriter::bit(t);
+        }
+
+        //! NOTE Not indexed head, the index was rebuilt (other version) while the file was written
+        if (!index.blocks().isEmpty() && index.blocks().first().offset > 0) {
+            scanRange(data, 0, qMin(index.blocks().first().offset, fileSize), parser, date, query, out);
+        }
+
+        foreach (const LogIndexBlock &b, index.find(query.fromMsecs, query.toMsecs, types, tags)) {
+            if (b.offset + b.size <= fileSize) {
+                scanRange(data, b.offset, b.offset + b.size, parser, date, query, out);
+            }
+        }
+
+        scanFrom = qMin(index.indexedSize(), fileSize);
+    }
+
+    //! NOTE Not indexed tail (last block is not written yet) or the whole file without index
+    scanRange(data, scanFrom, fileSize, parser, date, query, out);
+
+    out.flush();
+    return 0;
+}